@@ -0,0 +1,159 @@
+#include "affinity.h"
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace {
+
+const char sysfs_node_dir[] = "/sys/devices/system/node";
+
+// Returns the CPUs the process may run on.
+std::vector<int> AllowedCpus() {
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+// Returns the numbers of the NUMA nodes listed in sysfs, in ascending order.
+std::vector<int> SysfsNodes() {
+    std::vector<int> nodes;
+    DIR *dir = opendir(sysfs_node_dir);
+    if (!dir) return nodes;
+    while (const dirent *entry = readdir(dir)) {
+        const char *name = entry->d_name;
+        if (strncmp(name, "node", 4) != 0 || name[4] < '0' || name[4] > '9') continue;
+        char *end = nullptr;
+        long node = strtol(name + 4, &end, 10);
+        if (*end == '\0') nodes.push_back(node);
+    }
+    closedir(dir);
+    std::sort(nodes.begin(), nodes.end());
+    return nodes;
+}
+
+}  // namespace
+
+int CpuTopology::NumCpus() const {
+    int n = 0;
+    for (const std::vector<int> &cpus : nodes) n += cpus.size();
+    return n;
+}
+
+CpuTopology DetectTopology() {
+    const std::vector<int> allowed = AllowedCpus();
+    CpuTopology topology;
+    for (int node : SysfsNodes()) {
+        std::ifstream is(std::string(sysfs_node_dir) + "/node" + std::to_string(node) + "/cpulist");
+        std::string list;
+        if (!std::getline(is, list)) continue;
+        std::optional<std::vector<int>> cpus = ParseCpuList(list);
+        if (!cpus) continue;
+        std::vector<int> usable;
+        for (int cpu : *cpus) {
+            if (std::binary_search(allowed.begin(), allowed.end(), cpu)) usable.push_back(cpu);
+        }
+        // Nodes with memory only, or CPUs we may not use, can't run workers.
+        if (!usable.empty()) topology.nodes.push_back(usable);
+    }
+    if (topology.nodes.empty() && !allowed.empty()) topology.nodes.push_back(allowed);
+    return topology;
+}
+
+const CpuTopology &SystemTopology() {
+    static const CpuTopology topology = DetectTopology();
+    return topology;
+}
+
+std::optional<std::vector<int>> ParseCpuList(const std::string &list) {
+    std::vector<int> cpus;
+    std::istringstream iss(list);
+    for (std::string range; std::getline(iss, range, ','); ) {
+        if (range.empty()) continue;
+        char *end = nullptr;
+        long first = strtol(range.c_str(), &end, 10);
+        long last = first;
+        if (*end == '-') last = strtol(end + 1, &end, 10);
+        if (end == range.c_str() || *end != '\0' || first < 0 || last < first || last >= CPU_SETSIZE) {
+            return std::nullopt;
+        }
+        for (long cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+    }
+    if (cpus.empty()) return std::nullopt;
+    std::sort(cpus.begin(), cpus.end());
+    cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+    return cpus;
+}
+
+std::optional<CpuTopology> ParseTopology(const std::string &spec) {
+    CpuTopology topology;
+    std::istringstream iss(spec);
+    for (std::string list; std::getline(iss, list, '/'); ) {
+        std::optional<std::vector<int>> cpus = ParseCpuList(list);
+        if (!cpus) return std::nullopt;
+        topology.nodes.push_back(*cpus);
+    }
+    if (topology.nodes.empty()) return std::nullopt;
+    return topology;
+}
+
+std::string FormatTopology(const CpuTopology &topology) {
+    std::ostringstream oss;
+    for (size_t node = 0; node < topology.nodes.size(); ++node) {
+        if (node > 0) oss << '/';
+        const std::vector<int> &cpus = topology.nodes[node];
+        for (size_t i = 0; i < cpus.size(); ) {
+            size_t j = i;
+            while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) ++j;
+            if (i > 0) oss << ',';
+            oss << cpus[i];
+            if (j > i) oss << '-' << cpus[j];
+            i = j + 1;
+        }
+    }
+    return oss.str();
+}
+
+std::optional<Affinity> ParseAffinity(const std::string &name) {
+    if (name == "none") return Affinity::NONE;
+    if (name == "node") return Affinity::NODE;
+    if (name == "cpu") return Affinity::CPU;
+    return std::nullopt;
+}
+
+Placement PlaceWorker(const CpuTopology &topology, Affinity affinity, int worker) {
+    if (topology.nodes.empty()) return Placement{0, {}};
+    const int node = worker % topology.nodes.size();
+    const std::vector<int> &cpus = topology.nodes[node];
+    switch (affinity) {
+    case Affinity::NONE: return Placement{node, {}};
+    case Affinity::NODE: return Placement{node, cpus};
+    case Affinity::CPU: return Placement{node, {cpus[worker / topology.nodes.size() % cpus.size()]}};
+    }
+    return Placement{node, {}};
+}
+
+bool PinCurrentThread(const std::vector<int> &cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) CPU_SET(cpu, &set);
+    int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (error != 0) {
+        std::cerr << "Could not pin thread to CPUs: " << strerror(error) << std::endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,58 @@
+#ifndef AFFINITY_H_INCLUDED
+#define AFFINITY_H_INCLUDED
+
+#include <optional>
+#include <string>
+#include <vector>
+
+// CPU topology and thread placement, for keeping search threads (and the
+// memory they allocate, which the kernel places on the NUMA node of the CPU
+// that first touches it) on the same node.
+
+// The CPUs of each NUMA node that the process may run on.
+struct CpuTopology {
+    std::vector<std::vector<int>> nodes;
+
+    int NumCpus() const;
+};
+
+// Reads the topology from /sys/devices/system/node, restricted to the CPUs in
+// the process's affinity mask. Without NUMA information, all CPUs form a
+// single node.
+CpuTopology DetectTopology();
+
+// The result of DetectTopology(), which is only called once.
+const CpuTopology &SystemTopology();
+
+// Parses a topology written as CPU lists separated by slashes, one per node,
+// e.g. "0-7,16-23/8-15,24-31".
+std::optional<CpuTopology> ParseTopology(const std::string &spec);
+std::string FormatTopology(const CpuTopology &topology);
+
+// Parses a CPU list as in sysfs, e.g. "0-3,8,10-11".
+std::optional<std::vector<int>> ParseCpuList(const std::string &list);
+
+// How worker threads are pinned to CPUs.
+enum class Affinity {
+    NONE,  // not at all; the scheduler may move threads between nodes
+    NODE,  // to all CPUs of one node
+    CPU,   // to a single CPU
+};
+
+std::optional<Affinity> ParseAffinity(const std::string &name);
+
+// Where a worker runs: the node, and the CPUs it's pinned to (empty if not
+// pinned). Workers are spread over the nodes in turn, and over the CPUs of
+// each node.
+struct Placement {
+    int node;
+    std::vector<int> cpus;
+};
+
+Placement PlaceWorker(const CpuTopology &topology, Affinity affinity, int worker);
+
+// Restricts the calling thread to the given CPUs. Returns false (after
+// printing a message) on failure.
+bool PinCurrentThread(const std::vector<int> &cpus);
+
+#endif /* ndef AFFINITY_H_INCLUDED */
@@ -0,0 +1,86 @@
+#include "ai.h"
+
+#include <assert.h>
+
+#include <algorithm>
+#include <limits>
+
+std::shared_ptr<SearchHandle> Ai::PrepareSearch(
+        const SearchBudget &budget, std::function<void(Move)> on_complete) {
+    return std::shared_ptr<SearchHandle>(new SearchHandle(*this, budget, std::move(on_complete)));
+}
+
+std::shared_ptr<SearchHandle> Ai::StartSearch(
+        const SearchBudget &budget, std::function<void(Move)> on_complete) {
+    std::shared_ptr<SearchHandle> handle = PrepareSearch(budget, std::move(on_complete));
+    // Slices are small enough to respond to Stop() and the time limit quickly.
+    SearchHandle *h = handle.get();
+    handle->thread = std::thread([h]{ while (h->RunSlice(1000)) {} });
+    return handle;
+}
+
+SearchHandle::SearchHandle(Ai &ai, const SearchBudget &budget, std::function<void(Move)> on_complete)
+        : ai(ai), on_complete(std::move(on_complete)), future(promise.get_future().share()) {
+    max_iterations =
+            budget.max_iterations > 0 ? budget.max_iterations :
+            budget.max_time.count() > 0 ? std::numeric_limits<int64_t>::max() :
+            ai.DefaultIterations();
+    if (budget.max_time.count() > 0) {
+        deadline = std::chrono::steady_clock::now() + budget.max_time;
+    }
+}
+
+SearchHandle::~SearchHandle() {
+    if (thread.joinable()) {
+        Stop();
+        if (thread.get_id() == std::this_thread::get_id()) {
+            // Destroyed from the completion callback.
+            thread.detach();
+        } else {
+            thread.join();
+        }
+    }
+}
+
+std::optional<Move> SearchHandle::BestMove() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return best_move;
+}
+
+bool SearchHandle::RunSlice(int max_slice_iterations) {
+    if (done) return false;
+    if (!started) {
+        started = true;
+        if (std::optional<Move> move = ai.BeginSearch()) {
+            Finish(*move);
+            return false;
+        }
+    }
+    int64_t n = std::min<int64_t>(max_slice_iterations, max_iterations - iterations);
+    bool more = n > 0 && !stop_requested && ai.ContinueSearch(n);
+    iterations += std::max<int64_t>(n, 0);
+    Move move = ai.SearchResult();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        best_move = move;
+    }
+    if (!more || stop_requested || iterations >= max_iterations ||
+            (deadline && std::chrono::steady_clock::now() >= *deadline)) {
+        Finish(move);
+        return false;
+    }
+    return true;
+}
+
+void SearchHandle::Finish(Move move) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        best_move = move;
+    }
+    done = true;
+    promise.set_value(move);
+    // The callback may destroy the handle, and with it `on_complete`, so it
+    // must not be called in place. Nothing else is touched after it returns.
+    std::function<void(Move)> callback = std::move(on_complete);
+    if (callback) callback(move);
+}
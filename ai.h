@@ -3,11 +3,125 @@
 
 #include "quarto.h"
 
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+class SearchHandle;
+
+// Limits for an asynchronous search. The search stops at whichever limit is
+// reached first (or earlier, if it's stopped or the best move is certain).
+struct SearchBudget {
+    // Maximum number of iterations, or 0 to use the AI's default (or no limit,
+    // if a time limit is given).
+    int64_t max_iterations = 0;
+
+    // Maximum duration of the search, or 0 for no time limit.
+    std::chrono::milliseconds max_time{0};
+};
+
 class Ai {
 public:
     virtual ~Ai() = default;
     virtual bool Execute(Move move) = 0;
     virtual Move CalculateMove() = 0;
+
+    // Starts calculating a move on a background thread. The callback (if any)
+    // is called with the chosen move when the search completes, on the thread
+    // that completed it. The callback may release the last reference to the
+    // handle.
+    //
+    // While the search is running, no other methods may be called on the AI,
+    // and the AI must outlive the returned handle.
+    std::shared_ptr<SearchHandle> StartSearch(
+            const SearchBudget &budget, std::function<void(Move)> on_complete = nullptr);
+
+    // Like StartSearch(), but doesn't start a thread: the caller must drive
+    // the search by calling SearchHandle::RunSlice() until it returns false.
+    // This allows many searches to share a pool of threads.
+    std::shared_ptr<SearchHandle> PrepareSearch(
+            const SearchBudget &budget, std::function<void(Move)> on_complete = nullptr);
+
+protected:
+    friend class SearchHandle;
+
+    // Incremental search interface used by SearchHandle. The default
+    // implementation just calls CalculateMove(), which can't be interrupted.
+
+    // Prepares to search the current position. Returns the move to play if it
+    // can be determined without searching.
+    virtual std::optional<Move> BeginSearch() { return CalculateMove(); }
+
+    // Runs up to `iterations` iterations of the search. Returns false if
+    // further iterations can't change the result.
+    virtual bool ContinueSearch(int iterations) { (void)iterations; return false; }
+
+    // Returns the best move based on the search so far.
+    virtual Move SearchResult() { return CalculateMove(); }
+
+    // Number of iterations to use if the budget doesn't say.
+    virtual int64_t DefaultIterations() const { return 0; }
+};
+
+// Tracks the progress of an asynchronous search. All methods are thread-safe,
+// except RunSlice(), which must not be called concurrently with itself.
+class SearchHandle {
+public:
+    ~SearchHandle();
+
+    // Returns the best move found so far, if any.
+    std::optional<Move> BestMove() const;
+
+    // Number of iterations completed so far.
+    int64_t Iterations() const { return iterations; }
+
+    // Whether the search has finished.
+    bool Done() const { return done; }
+
+    // Asks the search to stop as soon as possible. It will then complete with
+    // the best move found so far.
+    void Stop() { stop_requested = true; }
+
+    // Blocks until the search is done, and returns the chosen move.
+    Move Wait() { return future.get(); }
+
+    // Returns a future for the chosen move.
+    std::shared_future<Move> Future() const { return future; }
+
+    // Runs up to `max_iterations` iterations (fewer if the budget runs out).
+    // Returns true while there is more work to do.
+    bool RunSlice(int max_iterations);
+
+private:
+    friend class Ai;
+
+    SearchHandle(Ai &ai, const SearchBudget &budget, std::function<void(Move)> on_complete);
+
+    void Finish(Move move);
+
+    Ai &ai;
+    int64_t max_iterations;
+    std::optional<std::chrono::steady_clock::time_point> deadline;
+    std::function<void(Move)> on_complete;
+    bool started = false;
+
+    std::atomic<int64_t> iterations{0};
+    std::atomic<bool> stop_requested{false};
+    std::atomic<bool> done{false};
+
+    mutable std::mutex mutex;  // protects best_move
+    std::optional<Move> best_move;
+
+    std::promise<Move> promise;
+    std::shared_future<Move> future;
+    std::thread thread;  // only used by Ai::StartSearch()
 };
 
 #endif /* ndef AI_H_INCLUDED */
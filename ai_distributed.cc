@@ -0,0 +1,223 @@
+#include "ai_distributed.h"
+
+#include "notation.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <iostream>
+#include <sstream>
+
+namespace {
+
+const std::chrono::seconds min_worker_wait(1);
+
+std::mt19937 SeedEngine() {
+    std::random_device dev;
+    std::seed_seq seed = {dev(), dev(), dev(), dev()};
+    return std::mt19937(seed);
+}
+
+std::string FormatStats(const std::vector<MoveStats> &stats) {
+    std::ostringstream oss;
+    oss << "stats " << stats.size() << '\n';
+    for (const MoveStats &s : stats) {
+        oss << EncodeMove(s.move) << ' ' << s.visits << ' ' << s.wins << ' ' << s.losses << ' ';
+        if (s.fixed_value) oss << *s.fixed_value; else oss << '?';
+        oss << '\n';
+    }
+    return oss.str();
+}
+
+// Reads a "stats" response. Returns false if the worker failed, or didn't
+// answer by the deadline.
+bool ReadStats(LineReader &reader, std::chrono::steady_clock::time_point deadline,
+        std::vector<MoveStats> &stats) {
+    std::string line;
+    if (!reader.ReadLine(line, deadline)) return false;
+    std::istringstream header(line);
+    std::string word;
+    int count = -1;
+    if (!(header >> word >> count) || word != "stats" || count < 0 || count > 16) {
+        std::cerr << "(AI) Unexpected worker response: " << line << std::endl;
+        return false;
+    }
+    for (int i = 0; i < count; ++i) {
+        if (!reader.ReadLine(line, deadline)) return false;
+        std::istringstream iss(line);
+        char move_char = 0;
+        std::string fixed;
+        MoveStats s = {Move::Pass(), 0, 0, 0, std::nullopt};
+        if (!(iss >> move_char >> s.visits >> s.wins >> s.losses >> fixed)) return false;
+        std::optional<Move> move = DecodeMove(move_char);
+        if (!move) return false;
+        s.move = *move;
+        if (fixed == "-1" || fixed == "0" || fixed == "1") {
+            s.fixed_value = std::stoi(fixed);
+        } else if (fixed != "?") {
+            return false;
+        }
+        stats.push_back(s);
+    }
+    return true;
+}
+
+// Handles a single request line and returns the response.
+std::string HandleRequest(const std::string &line) {
+    std::istringstream iss(line);
+    std::string command, position;
+    int iterations = 0;
+    unsigned seed = 0;
+    if (!(iss >> command >> position >> iterations >> seed) || command != "search") {
+        return "error malformed request\n";
+    }
+    AiMctsConfig config;
+    std::string config_spec;
+    if (iss >> config_spec && !ParseAiMctsConfig(config_spec, config)) {
+        return "error invalid search parameters\n";
+    }
+    if (position == "-") position.clear();
+    std::optional<State> state = DecodeState(position);
+    if (!state) {
+        return "error invalid position\n";
+    }
+    if (state->Over()) {
+        return FormatStats({});
+    }
+    AiMcts ai(*state, seed, config);
+    ai.Search(iterations);
+    return FormatStats(ai.RootStats());
+}
+
+}  // namespace
+
+AiDistributed::AiDistributed(const State &state, std::vector<int> worker_fds,
+        const AiMctsConfig &config)
+        : state(state), config(FormatAiMctsConfig(config)), local(state, config), seed_engine(SeedEngine()) {
+    for (int fd : worker_fds) {
+        workers.push_back(Worker{fd, LineReader(fd)});
+    }
+}
+
+AiDistributed::~AiDistributed() {
+    for (const Worker &worker : workers) close(worker.fd);
+}
+
+bool AiDistributed::Execute(Move move) {
+    if (!state.Execute(move)) return false;
+    bool ok = local.Execute(move);
+    assert(ok);
+    return ok;
+}
+
+Move AiDistributed::CalculateMove() {
+    if (std::optional<Move> move = local.ImmediateMove()) {
+        return *move;
+    }
+    const int iterations = local.IterationsPerMove();
+    std::string position = EncodeState(state);
+    if (position.empty()) position = "-";
+
+    // Send out requests first, so workers search while we do.
+    std::vector<bool> pending(workers.size());
+    for (size_t i = 0; i < workers.size(); ++i) {
+        std::ostringstream request;
+        request << "search " << position << ' ' << iterations << ' ' << seed_engine() << ' '
+                << config << '\n';
+        pending[i] = WriteAll(workers[i].fd, request.str());
+    }
+    const auto start = std::chrono::steady_clock::now();
+    local.Search(iterations);
+    const auto end = std::chrono::steady_clock::now();
+
+    // The workers do as much work as we did, so give them as long again (and
+    // some slack) to answer. A worker that misses the deadline is dropped, so
+    // its late answer can't be taken for the answer to the next request.
+    const auto deadline = end + (end - start) + min_worker_wait;
+    std::vector<Worker> remaining;
+    for (size_t i = 0; i < workers.size(); ++i) {
+        std::vector<MoveStats> stats;
+        if (pending[i] && ReadStats(workers[i].reader, deadline, stats)) {
+            local.MergeRootStats(stats);
+            remaining.push_back(std::move(workers[i]));
+        } else {
+            std::cerr << "(AI) No answer from worker " << i << ", disconnecting!" << std::endl;
+            close(workers[i].fd);
+        }
+    }
+    workers = std::move(remaining);
+    return local.BestMove();
+}
+
+void ServeWorker(int fd) {
+    LineReader reader(fd);
+    std::string line;
+    while (reader.ReadLine(line)) {
+        if (line.empty()) continue;
+        if (!WriteAll(fd, HandleRequest(line))) break;
+    }
+}
+
+int RunWorker(const std::string &address) {
+    int listen_fd = ListenOn(address);
+    if (listen_fd < 0) return 1;
+    std::cerr << "Worker listening on " << address << std::endl;
+    for (;;) {
+        int fd = AcceptConnection(listen_fd);
+        if (fd < 0) {
+            perror("accept");
+            return 1;
+        }
+        ServeWorker(fd);
+        close(fd);
+    }
+}
+
+std::vector<int> ConnectToWorkers(const std::string &addresses) {
+    std::vector<int> fds;
+    std::istringstream iss(addresses);
+    std::string address;
+    while (std::getline(iss, address, ',')) {
+        int fd = ConnectTo(address);
+        if (fd < 0) {
+            for (int fd : fds) close(fd);
+            return {};
+        }
+        fds.push_back(fd);
+    }
+    return fds;
+}
+
+std::vector<int> SpawnLocalWorkers(int count) {
+    std::vector<int> fds;
+    // Flush output before forking, so buffered output isn't written twice.
+    std::cout.flush();
+    std::cerr.flush();
+    for (int i = 0; i < count; ++i) {
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+            perror("socketpair");
+            break;
+        }
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            close(sv[0]);
+            close(sv[1]);
+            break;
+        }
+        if (pid == 0) {
+            // Child process: serve requests until the coordinator exits.
+            for (int fd : fds) close(fd);
+            close(sv[0]);
+            ServeWorker(sv[1]);
+            _exit(0);
+        }
+        close(sv[1]);
+        fds.push_back(sv[0]);
+    }
+    return fds;
+}
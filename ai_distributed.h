@@ -0,0 +1,81 @@
+#ifndef AI_DISTRIBUTED_H_INCLUDED
+#define AI_DISTRIBUTED_H_INCLUDED
+
+#include "quarto.h"
+#include "ai.h"
+#include "ai_mcts.h"
+#include "net.h"
+
+#include <random>
+#include <string>
+#include <vector>
+
+// Spreads a search across several worker processes.
+//
+// The coordinator sends the current position to every worker, which each run
+// an independent Monte Carlo search with a different seed (while the
+// coordinator searches locally, too). The statistics of the root's children
+// are then merged into the coordinator's root node, and the best move is
+// chosen from the combined statistics. Workers that haven't answered by the
+// time the coordinator has waited as long as its own search took (plus a
+// second) are disconnected, and the move is chosen without them.
+//
+// The protocol is line-based. The coordinator sends:
+//
+//   search <position> <iterations> <seed> [<config>]
+//
+// where <position> is a compact move string (or "-" for the initial state),
+// and <config> the search parameters as formatted by FormatAiMctsConfig().
+// (A position database can't be sent, so only the coordinator's own search
+// uses one.)
+// The worker replies with:
+//
+//   stats <n>
+//   <move> <visits> <wins> <losses> <fixed>    (n lines)
+//
+// where <move> is a compactly encoded move and <fixed> is the fixed value of
+// the child (-1, 0, +1) or "?" if it isn't known. On invalid input the worker
+// replies with "error <message>" instead.
+class AiDistributed : public Ai {
+public:
+    // Takes ownership of the given sockets, which must be connected to
+    // workers. The workers search with the same configuration.
+    AiDistributed(const State &state, std::vector<int> worker_fds,
+            const AiMctsConfig &config = AiMctsConfig());
+    ~AiDistributed();
+    bool Execute(Move move) override;
+    Move CalculateMove() override;
+
+    // The local search, which also holds the workers' statistics after
+    // CalculateMove().
+    const AiMcts &LastSearch() const { return local; }
+
+private:
+    struct Worker {
+        int fd;
+        LineReader reader;
+    };
+
+    State state;
+    std::string config;  // formatted for the workers
+    AiMcts local;
+    std::vector<Worker> workers;
+    std::mt19937 seed_engine;
+};
+
+// Serves search requests on a connected socket until it is closed.
+void ServeWorker(int fd);
+
+// Listens on the given address and serves coordinators one at a time.
+// Only returns on failure.
+int RunWorker(const std::string &address);
+
+// Connects to workers at a comma-separated list of addresses. Returns an empty
+// list on failure.
+std::vector<int> ConnectToWorkers(const std::string &addresses);
+
+// Forks the given number of local worker processes, connected through socket
+// pairs. Returns the coordinator's ends of the sockets.
+std::vector<int> SpawnLocalWorkers(int count);
+
+#endif /* ndef AI_DISTRIBUTED_H_INCLUDED */
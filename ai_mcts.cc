@@ -1,42 +1,34 @@
 #include "ai_mcts.h"
 
+#include "enhanced_state.h"
+#include "pns.h"
+#include "position_db.h"
+#include "symmetry.h"
+#include "trace.h"
+
 #include <assert.h>
+#include <limits.h>
+#include <stdlib.h>
 
 #include <algorithm>
+#include <cmath>
 #include <iterator>
 #include <iostream>
 #include <iomanip>
+#include <limits>
 #include <memory>
+#include <new>
 #include <optional>
+#include <sstream>
+#include <unordered_map>
 
 namespace {
 
 using ai_internal::Node;
+using ai_internal::NodePtr;
+using ai_internal::PositionCache;
 using ai_internal::random_engine_t;
 
-constexpr int exploration_factor = 2;
-constexpr int iterations_per_move = 1000000;
-constexpr bool debug_print_moves = true;
-constexpr bool debug_print_expected_value = true;
-
-static signed char lines_per_field[16][4] = {
-    {0, 4, 8, -1},
-    {0, 5, -1},
-    {0, 6, -1},
-    {0, 7, 9, -1},
-    {1, 4, -1},
-    {1, 5, 8, -1},
-    {1, 6, 9, -1},
-    {1, 7, -1},
-    {2, 4, -1},
-    {2, 5, 9, -1},
-    {2, 6, 8, -1},
-    {2, 7, -1},
-    {3, 4, 9, -1},
-    {3, 5, -1},
-    {3, 6, -1},
-    {3, 7, 8, -1}};
-
 enum class Result : signed char { LOSS = -1, TIE = 0, WIN = +1 };
 
 struct Outcome {
@@ -46,29 +38,6 @@ struct Outcome {
     bool operator==(const Outcome &o) { return result == o.result && fixed == o.fixed; }
 };
 
-struct LineInfo {
-    unsigned char common_values = 0xff;
-    unsigned char spaces_left = 4;
-};
-
-struct EnhancedState {
-    // Number of next piece to place, or -1 if we need to select the next piece.
-    signed char next_piece = -1;
-
-    // Bitmask of available pieces.
-    unsigned short pieces = 0xffff;
-
-    // For each field, the number of a piece, or -1 if the field is empty.
-    std::array<signed char, 16> fields = {
-        -1, -1, -1, -1,
-        -1, -1, -1, -1,
-        -1, -1, -1, -1,
-        -1, -1, -1, -1};
-
-    // State of each line on the board.
-    std::array<LineInfo, 10> lines;
-};
-
 random_engine_t SeedRandomEngine() {
     // Seed with 8 random integers, or 256 bits, which should be enough.
     std::random_device dev;
@@ -76,10 +45,6 @@ random_engine_t SeedRandomEngine() {
     return random_engine_t(seed);
 }
 
-constexpr unsigned AttributeValues(int piece) {
-    return (piece << 4) | (piece ^ 0xf);
-}
-
 Result Invert(Result r) { return static_cast<Result>(-static_cast<int>(r)); }
 
 int GameValue(Result r) { return static_cast<int>(r); }
@@ -99,92 +64,18 @@ Move RandomMove(const std::vector<Move> &moves, random_engine_t &random_engine)
     return moves[RandomIndex(moves.size(), random_engine)];
 }
 
-EnhancedState EnhanceState(const State &state) {
-    EnhancedState est;
-    switch (state.NextAction()) {
-    case NextAction::SELECT:
-        est.next_piece = -1;
-        break;
-    case NextAction::PLACE:
-        est.next_piece = state.LastPiece();
-        est.pieces -= 1 << est.next_piece;
-        break;
-    default:
-        assert(false);
-    }
-    for (int i = 0; i < 16; ++i) {
-        int piece = state.PieceAt(i);
-        if (piece < 0) {
-            est.fields[i] = -1;
-        } else {
-            assert(est.pieces & (1 << piece));
-            est.fields[i] = piece;
-            est.pieces -= 1 << piece;
-            unsigned values = AttributeValues(piece);
-            for (signed char *p = lines_per_field[i]; *p >= 0; ++p) {
-                LineInfo &line = est.lines[*p];
-                line.spaces_left -= 1;
-                line.common_values &= values;
-            }
-        }
-    }
-    return est;
-}
-
-int ListNonlosingMoves(const EnhancedState &est, std::array<int, 16> &moves) {
-    unsigned char winning_values = 0;
-    for (const LineInfo &line : est.lines) {
-        if (line.spaces_left == 1) {
-            winning_values |= line.common_values;
-        }
-    }
-    int n = 0;
-    if (est.next_piece < 0) {
-        // We must select the piece to place.
-        // Consider only moves that don't allow the opponent to win immediately.
-        for (int i = 0; i < 16; ++i) {
-            if ((est.pieces & (1 << i)) == 0) continue;
-            if ((winning_values & AttributeValues(i)) != 0) continue;
-            moves[n++] = i;
-        }
-    } else {
-        // We must place a piece. Any empty field works.
-        for (int i = 0; i < 16; ++i) {
-            if (est.fields[i] < 0) {
-                moves[n++] = i;
-            }
-        }
-    }
-    return n;
-}
-
-void Select(EnhancedState &est, int piece) {
-    assert(piece >= 0 && piece < 16);
-    assert(est.next_piece == -1);
-    assert(est.pieces & (1 << piece));
-    est.next_piece = piece;
-    est.pieces -= (1 << piece);
-}
-
-void Place(EnhancedState &est, int field) {
-    assert(field >= 0 && field < 16);
-    assert(est.next_piece >= 0);
-    assert(est.fields[field] < 0);
-    int piece = est.next_piece;
-    est.next_piece = -1;
-    est.fields[field] = piece;
-    unsigned values = AttributeValues(piece);
-    for (signed char *p = lines_per_field[field]; *p >= 0; ++p) {
-        LineInfo &line = est.lines[*p];
-        line.spaces_left -= 1;
-        line.common_values &= values;
-    }
-}
-
 }  // namespace
 
 namespace ai_internal {
 
+// All-moves-as-first statistics of a node, indexed by move: the number of
+// iterations through the node in which the player to move made the move at
+// any later point, and the sum of the game values for this player.
+struct AmafStats {
+    std::array<int, 16> visits = {};
+    std::array<int, 16> score = {};
+};
+
 class Node {
 public:
     explicit Node(const EnhancedState &est);
@@ -192,6 +83,10 @@ public:
     Outcome Fix(Result result);
     Node &ExpandChild();
 
+    // Pool that this node was allocated from, and that its children are
+    // allocated from.
+    NodePool *pool = nullptr;
+
     EnhancedState est;
 
     // Number of times this node was visited.
@@ -206,11 +101,202 @@ public:
     // Exact value of the node, if known.
     std::optional<Result> fixed_value = std::nullopt;
 
+    // Lower and upper bounds on the value of the node (-1, 0 or +1), which
+    // are equal once the value is fixed.
+    signed char pessimistic = -1;
+    signed char optimistic = +1;
+
+    // Move that achieves the fixed value, if it was found by proof-number
+    // search instead of by expanding children.
+    signed char proven_move = -1;
+
+    // Whether proof-number search was tried on the node (in hybrid mode).
+    bool pns_tried = false;
+
     // Successor states.
     int num_moves;
     int num_expanded = 0;  // 0 <= num_expanded <= num_moves
     std::array<int, 16> moves;  // only first num_moves elements are valid
-    std::array<std::unique_ptr<Node>, 16> children;  // only first num_expanded elements are valid
+    std::array<NodePtr, 16> children;  // only first num_expanded elements are valid
+
+    // All-moves-as-first statistics, allocated from the pool when they're
+    // first updated, so nodes only take up memory for them with RAVE.
+    AmafStats *amaf = nullptr;
+};
+
+// Allocates objects from large chunks of memory. Freed objects are kept on a
+// free list for reuse. Not thread-safe.
+template<class T>
+class FreeListAllocator {
+public:
+    FreeListAllocator() = default;
+    FreeListAllocator(const FreeListAllocator&) = delete;
+    FreeListAllocator &operator=(const FreeListAllocator&) = delete;
+
+    ~FreeListAllocator() { assert(in_use == 0); }
+
+    template<class... Args>
+    T *New(Args&&... args) {
+        if (!free_list) Grow(std::max<size_t>(capacity, min_chunk_size));
+        Slot *slot = free_list;
+        free_list = slot->next;
+        T *object = new (slot->storage) T(std::forward<Args>(args)...);
+        ++in_use;
+        return object;
+    }
+
+    void Free(T *object) {
+        object->~T();
+        Slot *slot = reinterpret_cast<Slot*>(object);
+        slot->next = free_list;
+        free_list = slot;
+        --in_use;
+    }
+
+    // Makes sure there is memory for at least `count` objects in total.
+    void Reserve(size_t count) {
+        if (count > capacity) Grow(count - capacity);
+    }
+
+    size_t InUse() const { return in_use; }
+    size_t Capacity() const { return capacity; }
+
+private:
+    static constexpr size_t min_chunk_size = 1024;
+
+    union Slot {
+        Slot *next;
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+    void Grow(size_t count) {
+        chunks.emplace_back(new Slot[count]);
+        Slot *chunk = chunks.back().get();
+        for (size_t i = count; i > 0; --i) {
+            chunk[i - 1].next = free_list;
+            free_list = &chunk[i - 1];
+        }
+        capacity += count;
+    }
+
+    std::vector<std::unique_ptr<Slot[]>> chunks;
+    Slot *free_list = nullptr;
+    size_t capacity = 0;
+    size_t in_use = 0;
+};
+
+// Allocates nodes, and their all-moves-as-first statistics. Not thread-safe.
+class NodePool {
+public:
+    template<class... Args>
+    NodePtr New(Args&&... args) {
+        Node *node = nodes.New(std::forward<Args>(args)...);
+        node->pool = this;
+        return NodePtr(node);
+    }
+
+    void Free(Node *node) {
+        if (node->amaf) amaf_stats.Free(node->amaf);
+        nodes.Free(node);
+    }
+
+    AmafStats *NewAmafStats() { return amaf_stats.New(); }
+
+    // Makes sure there is memory for at least `count` nodes in total.
+    void Reserve(size_t count) { nodes.Reserve(count); }
+
+    size_t InUse() const { return nodes.InUse(); }
+    size_t Capacity() const { return nodes.Capacity(); }
+
+private:
+    FreeListAllocator<Node> nodes;
+    FreeListAllocator<AmafStats> amaf_stats;
+};
+
+void NodeDeleter::operator()(Node *node) const {
+    node->pool->Free(node);
+}
+
+// Statistics of nodes that were discarded from the tree when moves were
+// executed, indexed by position. When the same position is reached again by a
+// different sequence of moves, the new node starts with these statistics.
+//
+// Fixed values are not kept, since a node with a fixed value must have the
+// children that prove it.
+class PositionCache {
+public:
+    bool Empty() const { return entries.empty(); }
+    void Clear() { entries.clear(); }
+
+    // Records `node` and its descendants, except for the subtree rooted at
+    // `keep` (which may be null). Nodes are visited breadth-first, so the
+    // most visited ones come first, and at most max_harvest per call, which
+    // bounds the work done when a move is executed.
+    void Harvest(const Node &node, const Node *keep) {
+        if (&node == keep || node.visits < min_visits) return;
+        queue.assign(1, &node);
+        for (size_t next = 0; next < queue.size(); ++next) {
+            const Node &n = *queue[next];
+            ++harvested;
+            if (!n.fixed_value && entries.size() < max_entries) {
+                Entry &entry = entries[MakeKey(n.est)];
+                if (n.visits > entry.visits) entry = Entry{n.visits, n.wins, n.losses};
+            }
+            for (int i = 0; i < n.num_expanded && queue.size() < max_harvest; ++i) {
+                const Node *child = n.children[i].get();
+                if (child && child != keep && child->visits >= min_visits) queue.push_back(child);
+            }
+        }
+    }
+
+    // Removes positions that can't be reached from `est` anymore. Those are
+    // never looked up, so they only take up room, and the entries are only
+    // scanned once at least as many nodes were harvested since the last scan.
+    void Prune(const EnhancedState &est) {
+        if (harvested < entries.size()) return;
+        harvested = 0;
+        const PositionKey root_key = MakeKey(est);
+        uint64_t mask = 0;
+        for (int field = 0; field < 16; ++field) {
+            if (root_key.occupied & (1u << field)) mask |= uint64_t(15) << (4*field);
+        }
+        for (auto it = entries.begin(); it != entries.end(); ) {
+            const PositionKey &key = it->first;
+            if ((key.occupied & root_key.occupied) == root_key.occupied &&
+                    (key.board & mask) == root_key.board) {
+                ++it;
+            } else {
+                it = entries.erase(it);
+            }
+        }
+    }
+
+    // Initializes the statistics of a new node, if its position is known.
+    // Returns the number of visits it starts with, which must be added to
+    // the parent's visits.
+    int Seed(Node &node) const {
+        if (entries.empty() || node.fixed_value) return 0;
+        auto it = entries.find(MakeKey(node.est));
+        if (it == entries.end()) return 0;
+        node.visits = it->second.visits;
+        node.wins = it->second.wins;
+        node.losses = it->second.losses;
+        return node.visits;
+    }
+
+private:
+    // Nodes with fewer visits aren't worth remembering.
+    static constexpr int min_visits = 8;
+    static constexpr size_t max_entries = 1 << 20;
+    static constexpr size_t max_harvest = 1 << 12;
+
+    struct Entry {
+        int visits = 0, wins = 0, losses = 0;
+    };
+
+    std::unordered_map<PositionKey, Entry, PositionKeyHash> entries;
+    size_t harvested = 0;  // nodes visited by Harvest since the last scan
+    std::vector<const Node*> queue;
 };
 
 Node::Node(const EnhancedState &est) : est(est) {
@@ -225,6 +311,7 @@ Node::Node(const EnhancedState &parent_est, int move) : est(parent_est) {
 Outcome Node::Fix(Result result) {
     assert(!fixed_value);
     fixed_value = result;
+    pessimistic = optimistic = GameValue(result);
     // For debugging:
     wins = result == Result::WIN;
     losses = result == Result::LOSS;
@@ -239,8 +326,8 @@ Outcome Node::Fix(Result result) {
 Node &Node::ExpandChild() {
     assert(num_expanded < num_moves);
     int i = num_expanded++;
-    std::unique_ptr<Node> &child = children[i];
-    child = std::make_unique<Node>(est, moves[i]);
+    NodePtr &child = children[i];
+    child = pool->New(est, moves[i]);
     return *child;
 }
 
@@ -248,9 +335,75 @@ Node &Node::ExpandChild() {
 
 namespace {
 
-// Simulates a random playout.
-Result PlayOut(EnhancedState est, random_engine_t &random_engine) {
+// Randomly picks a result whose expected game value equals `value`, which
+// must be between -1 and +1.
+Result SampleResult(double value, random_engine_t &random_engine) {
+    double r = std::uniform_real_distribution<double>(0.0, 1.0)(random_engine);
+    if (r < value) return Result::WIN;
+    if (r < -value) return Result::LOSS;
+    return Result::TIE;
+}
+
+// Static evaluation of a position where a piece must be selected, from the
+// perspective of the selecting player, who has `num_safe` safe pieces left.
+//
+// If placing pieces doesn't create new threats, players take turns giving away
+// the safe pieces, and the player who runs out first loses, so an odd number of
+// safe pieces is good for the selecting player. This matters more as the
+// fraction of unsafe pieces grows, and less the more lines there are with two
+// pieces that share a value with a safe piece: placing it there creates a new
+// threat, which changes which pieces are safe.
+double Evaluate(const EnhancedState &est, int num_safe, double weight) {
+    assert(est.next_piece < 0);
+    int num_pieces = __builtin_popcount(est.pieces);
+    assert(num_safe > 0 && num_safe <= num_pieces);
+    unsigned char winning_values = 0;
+    for (const LineInfo &line : est.lines) {
+        if (line.spaces_left == 1) winning_values |= line.common_values;
+    }
+    unsigned char safe_values = 0;
+    for (int piece = 0; piece < 16; ++piece) {
+        if ((est.pieces & (1 << piece)) && (winning_values & AttributeValues(piece)) == 0) {
+            safe_values |= AttributeValues(piece);
+        }
+    }
+    int open_lines = 0;
+    for (const LineInfo &line : est.lines) {
+        if (line.spaces_left == 2 && (line.common_values & safe_values) != 0) ++open_lines;
+    }
+    double pressure = 1.0 * (num_pieces - num_safe) / num_pieces;
+    return weight * pressure / (1 + open_lines) * (num_safe % 2 == 1 ? 1 : -1);
+}
+
+// Moves made during one search iteration, both in the tree and in the
+// playout, for updating the all-moves-as-first statistics. Moves are indexed
+// by the number of pieces placed before them, and -1 where unknown.
+struct Trace {
+    std::array<signed char, 16> pieces;  // piece selected
+    std::array<signed char, 16> fields;  // field the piece was placed on
+
+    Trace() { Clear(); }
+
+    void Clear() {
+        pieces.fill(-1);
+        fields.fill(-1);
+    }
+
+    void Add(const EnhancedState &est, int move) {
+        (est.next_piece < 0 ? pieces : fields)[PiecesPlaced(est)] = move;
+    }
+
+    static int PiecesPlaced(const EnhancedState &est) {
+        return 16 - __builtin_popcount(est.pieces) - (est.next_piece >= 0);
+    }
+};
+
+// Simulates a random playout. If a cutoff depth is configured, the playout
+// stops after that many placements, and the result is sampled based on the
+// static evaluation of the position reached.
+Result PlayOut(EnhancedState est, const AiMctsConfig &config, random_engine_t &random_engine, Trace &trace) {
     Result win = Result::WIN;
+    int placements = 0;
     while (est.next_piece >= 0 || est.pieces != 0) {
         std::array<int, 16> moves;
         int num_moves = ListNonlosingMoves(est, moves);
@@ -258,54 +411,224 @@ Result PlayOut(EnhancedState est, random_engine_t &random_engine) {
             if (num_moves == 0) {
                 return Invert(win);
             }
+            if (config.playout_cutoff_depth > 0 && placements >= config.playout_cutoff_depth) {
+                Result result = SampleResult(
+                        Evaluate(est, num_moves, config.evaluation_weight), random_engine);
+                return result == Result::WIN ? win : result == Result::LOSS ? Invert(win) : result;
+            }
             int piece = moves[RandomIndex(num_moves, random_engine)];
+            trace.Add(est, piece);
             Select(est, piece);
             win = Invert(win);
         } else {
             assert(num_moves > 0);
             int field = moves[RandomIndex(num_moves, random_engine)];
+            trace.Add(est, field);
             Place(est, field);
+            ++placements;
         }
     }
     // All pieces have been placed, but nobody won. It's a tie!
     return Result::TIE;
 }
 
-Outcome ExpandTree(Node &node, random_engine_t &random_engine) {
+// Returns the bounds on the value of the child node from the perspective of
+// the parent.
+std::pair<int, int> BoundsForParent(const Node &parent, const Node &child) {
+    if (parent.est.next_piece < 0) return {-child.optimistic, -child.pessimistic};
+    return {child.pessimistic, child.optimistic};
+}
+
+// Recomputes the bounds of the node from those of its children: the player
+// to move can get at least the best lower bound of any child, and at most the
+// best upper bound, where unexpanded children might still be wins. Fixes the
+// value of the node if the bounds meet. Returns whether they changed.
+bool UpdateBounds(Node &node) {
+    if (node.fixed_value) return false;
+    int pessimistic = -1;
+    int optimistic = node.num_expanded < node.num_moves ? +1 : -1;
+    for (int i = 0; i < node.num_expanded; ++i) {
+        auto [lower, upper] = BoundsForParent(node, *node.children[i]);
+        pessimistic = std::max(pessimistic, lower);
+        optimistic = std::max(optimistic, upper);
+    }
+    if (pessimistic == node.pessimistic && optimistic == node.optimistic) return false;
+    node.pessimistic = pessimistic;
+    node.optimistic = optimistic;
+    if (pessimistic == optimistic) node.Fix(static_cast<Result>(pessimistic));
+    return true;
+}
+
+// Fixes the value of a node that has no non-losing moves.
+void FixIfTerminal(Node &node) {
+    if (node.num_moves == 0) {
+        assert(node.est.next_piece < 0);
+        node.Fix(node.est.pieces ? Result::LOSS : Result::TIE);
+    }
+}
+
+// Expands the child for the given move (if it's not expanded already) and
+// returns its index, or -1 if the move isn't one of the node's moves.
+int ExpandMove(Node &node, int move, const PositionCache *cache) {
+    int i = std::find(node.moves.begin(), node.moves.begin() + node.num_moves, move) -
+            node.moves.begin();
+    if (i == node.num_moves) return -1;
+    if (i >= node.num_expanded) {
+        // Children are expanded in order, so move it to the front of the
+        // unexpanded moves first.
+        std::swap(node.moves[i], node.moves[node.num_expanded]);
+        i = node.num_expanded;
+        Node &child = node.ExpandChild();
+        FixIfTerminal(child);
+        if (cache) node.visits += cache->Seed(child);
+    }
+    return i;
+}
+
+// Orders the moves of a new root by how often they were played in the games of
+// the database. Unless `max_visits` is 0, the children for moves that were
+// played are expanded, starting with the games' results as statistics.
+void ApplyPrior(Node &node, const PositionDatabase &db, int max_visits) {
+    if (node.fixed_value || node.num_expanded > 0) return;
+    std::optional<PositionStats> stats = db.Lookup(node.est);
+    if (!stats) return;
+    std::stable_sort(node.moves.begin(), node.moves.begin() + node.num_moves,
+            [&stats](int a, int b) { return stats->moves[a] > stats->moves[b]; });
+    if (max_visits <= 0) return;
+    for (int i = 0; i < node.num_moves && stats->moves[node.moves[i]] > 0; ++i) {
+        EnhancedState est = node.est;
+        if (est.next_piece < 0) Select(est, node.moves[i]); else Place(est, node.moves[i]);
+        // The game may have ended right after the move.
+        std::optional<PositionStats> child_stats = db.Lookup(est);
+        if (!child_stats) continue;
+        std::swap(node.moves[i], node.moves[node.num_expanded]);
+        Node &child = node.ExpandChild();
+        FixIfTerminal(child);
+        if (child.fixed_value) continue;
+        double scale = std::min(1.0, 1.0 * max_visits / child_stats->games);
+        child.visits = std::max(1L, std::lround(child_stats->games * scale));
+        child.wins = std::lround(child_stats->wins * scale);
+        child.losses = std::lround(child_stats->Losses() * scale);
+        node.visits += child.visits;
+    }
+    UpdateBounds(node);
+}
+
+// Everything the tree search uses besides the tree itself.
+struct SearchEnv {
+    const AiMctsConfig &config;
+    const PositionCache *cache;
+    ProofNumberSearch *pns;  // only in hybrid mode
+    random_engine_t &random_engine;
+    Trace trace = Trace();
+};
+
+// Credits the outcome of an iteration to every move that the player to move
+// at the node made from there on.
+void UpdateAmaf(Node &node, const Trace &trace, Result result) {
+    if (!node.amaf) node.amaf = node.pool->NewAmafStats();
+    const std::array<signed char, 16> &moves = node.est.next_piece < 0 ? trace.pieces : trace.fields;
+    for (int i = Trace::PiecesPlaced(node.est); i < 16 && moves[i] >= 0; i += 2) {
+        ++node.amaf->visits[moves[i]];
+        node.amaf->score[moves[i]] += GameValue(result);
+    }
+}
+
+// Returns the all-moves-as-first value of the move, from the perspective of
+// the player to move at the node.
+double AmafValue(const Node &node, int move) {
+    if (!node.amaf || node.amaf->visits[move] == 0) return 0.0;
+    return 1.0 * node.amaf->score[move] / node.amaf->visits[move];
+}
+
+// Moves the unexpanded move with the best all-moves-as-first value to the
+// front of the unexpanded moves, so that it's expanded next.
+void PreferAmafMove(Node &node) {
+    int best = node.num_expanded;
+    for (int i = best + 1; i < node.num_moves; ++i) {
+        if (AmafValue(node, node.moves[i]) > AmafValue(node, node.moves[best])) best = i;
+    }
+    std::swap(node.moves[best], node.moves[node.num_expanded]);
+}
+
+// Tries to fix the node's value with proof-number search.
+std::optional<Outcome> ProveNode(Node &node, ProofNumberSearch &pns, int64_t max_nodes) {
+    std::optional<int> value = pns.Solve(node.est, max_nodes);
+    if (!value) return std::nullopt;
+    if (*value >= 0) {
+        node.proven_move = pns.ProvingMove(node.est,
+                *value > 0 ? ProofNumberSearch::Goal::WIN : ProofNumberSearch::Goal::NON_LOSS);
+        // Without the move, we couldn't play the proven line.
+        if (node.proven_move < 0) return std::nullopt;
+    }
+    return node.Fix(static_cast<Result>(*value));
+}
+
+Outcome ExpandTree(Node &node, SearchEnv &env) {
     ++node.visits;
     if (node.fixed_value) {
         return Outcome{*node.fixed_value, true};
     }
+    // Seeded nodes may start with more visits than needed.
+    if (env.pns && !node.pns_tried && node.visits >= env.config.pns_visits) {
+        TRACE_SCOPE(PROOF);
+        node.pns_tried = true;
+        if (std::optional<Outcome> outcome = ProveNode(node, *env.pns, env.config.pns_max_nodes)) {
+            return *outcome;
+        }
+    }
     if (node.visits == 1) {
-        Result result = PlayOut(node.est, random_engine);
+        Result result;
+        {
+            TRACE_SCOPE(PLAYOUT);
+            result = PlayOut(node.est, env.config, env.random_engine, env.trace);
+        }
+        TRACE_SCOPE(BACKUP);
         if (result == Result::WIN) ++node.wins;
         if (result == Result::LOSS) ++node.losses;
+        if (env.config.rave_equivalence > 0) UpdateAmaf(node, env.trace, result);
         return Outcome{result, false};
     }
     assert(node.num_moves > 0);
     Node *child_ptr = nullptr;
-    bool child_value_fixed_before = false;
+    int child_index = -1;
+    // The node's bounds assume nothing about unexpanded children.
+    std::pair<int, int> child_bounds_before = {-1, +1};
     if (node.num_expanded < node.num_moves) {
         // Expand new child node.
+        TRACE_SCOPE(EXPANSION);
+        if (env.config.rave_equivalence > 0) PreferAmafMove(node);
         Node &child = node.ExpandChild();
-        if (child.num_moves == 0) {
-            assert(child.est.next_piece < 0);
-            child.Fix(child.est.pieces ? Result::LOSS : Result::TIE);
-        }
+        FixIfTerminal(child);
+        if (env.cache) node.visits += env.cache->Seed(child);
         child_ptr = &child;
+        child_index = node.num_expanded - 1;
     } else {
         // Select child node to revisit.
+        TRACE_SCOPE(SELECTION);
         double best_v = -1e99;
         int best_i = -1;
         for (int i = 0; i < node.num_moves; ++i) {
             const Node &child = *node.children[i];
-            assert(child.fixed_value || child.visits > 0);
+            // Skip children that can't improve on what the player to move
+            // can already get, including all children with fixed values.
+            if (BoundsForParent(node, child).second <= node.pessimistic) continue;
+            assert(child.visits > 0);
             double expected_value =
                 child.fixed_value ? GameValue(*child.fixed_value) :
                 1.0 * (child.wins - child.losses) / child.visits;
+            // After selecting a piece, the child's value is the opponent's.
+            if (node.est.next_piece < 0) expected_value = -expected_value;
+            if (env.config.rave_equivalence > 0 && !child.fixed_value) {
+                // Rely on the all-moves-as-first value while the child has
+                // few visits of its own.
+                double k = env.config.rave_equivalence;
+                double beta = sqrt(k / (3*child.visits + k));
+                expected_value = (1 - beta)*expected_value + beta*AmafValue(node, node.moves[i]);
+            }
             // TODO: maybe add some randomness for tie-breaking here?
             // better shuffle moves when generating them.
-            double variance = sqrt(exploration_factor * log(node.visits) / child.visits);
+            double variance = sqrt(env.config.exploration_factor * log(node.visits) / child.visits);
             double v = expected_value + variance;
             if (v > best_v) {
                 best_v = v;
@@ -314,45 +637,26 @@ Outcome ExpandTree(Node &node, random_engine_t &random_engine) {
         }
         assert(best_i >= 0);
         child_ptr = node.children[best_i].get();
-        child_value_fixed_before = child_ptr->fixed_value.has_value();
+        child_index = best_i;
+        child_bounds_before = {child_ptr->pessimistic, child_ptr->optimistic};
     }
     assert(child_ptr != nullptr);
     Node &child = *child_ptr;
-    Outcome child_outcome = ExpandTree(child, random_engine);
+    env.trace.Add(node.est, node.moves[child_index]);
+    Outcome child_outcome = ExpandTree(child, env);
 
     const Outcome outcome = node.est.next_piece < 0 ? Invert(child_outcome) : child_outcome;
-    if (!child_value_fixed_before && outcome.fixed) {
-        assert(child_outcome.result == child.fixed_value);
-        // Child's value just became fixed. Try to fix parent's value, too.
-        if (outcome.result == Result::WIN) {
-            // Win for current player!
-            return node.Fix(outcome.result);
-        }
-        // See if all child nodes values are fixed. If so, we can fix the parent
-        // node's value too. In that case, the value must be <= 0 because if
-        // there is any child node that could cause the parent to win, it would
-        // have been handled by the if-statement above.
-        if (node.num_expanded == node.num_moves) {
-            bool all_children_fixed = true;
-            int min_child_value = 1;
-            int max_child_value = -1;
-            for (int j = 0; j < node.num_expanded; ++j) {
-                if (!node.children[j]->fixed_value) {
-                    all_children_fixed = false;
-                    break;
-                }
-                min_child_value = std::min(min_child_value, GameValue(*node.children[j]->fixed_value));
-                max_child_value = std::max(max_child_value, GameValue(*node.children[j]->fixed_value));
-            }
-            if (all_children_fixed) {
-                int max_value = node.est.next_piece < 0 ? -min_child_value : max_child_value;
-                assert(max_value <= 0);
-                return node.Fix(max_value < 0 ? Result::LOSS : Result::TIE);
-            }
+    if (std::pair<int, int>(child.pessimistic, child.optimistic) != child_bounds_before) {
+        // The child's bounds changed, so the node's may have, too.
+        TRACE_SCOPE(SOLVER);
+        if (UpdateBounds(node) && node.fixed_value) {
+            return Outcome{*node.fixed_value, true};
         }
     }
+    TRACE_SCOPE(BACKUP);
     if (outcome.result == Result::WIN) ++node.wins;
     if (outcome.result == Result::LOSS) ++node.losses;
+    if (env.config.rave_equivalence > 0) UpdateAmaf(node, env.trace, outcome.result);
     return Outcome{outcome.result, false};
 }
 
@@ -368,19 +672,35 @@ Move GetBestMoveFromFixedNode(const Node &node, random_engine_t &random_engine)
                     Move::Place(node.moves[i]));
         }
     }
-    assert(!possible_moves.empty());
+    if (possible_moves.empty()) {
+        // The value was proven without expanding the children.
+        int move = node.proven_move;
+        if (move < 0) {
+            assert(*node.fixed_value == Result::LOSS);
+            move = node.moves[RandomIndex(node.num_moves, random_engine)];
+        }
+        return node.est.next_piece < 0 ? Move::Select(move) : Move::Place(move);
+    }
     return RandomMove(possible_moves, random_engine);
 }
 
-Move GetBestMove(Node &node, random_engine_t &random_engine) {
+// Runs a number of Monte Carlo simulations, stopping early if the value of
+// the node becomes fixed. Returns the number of simulations run.
+int RunSearch(Node &node, int iterations, SearchEnv &env) {
     assert(node.num_moves > 0);
-    // Run a large number of Monte Carlo simulations.
-    for (int it = 0; it < iterations_per_move; ++it) {
-        if (node.fixed_value) {
-            std::cout << "(AI) Root node has fixed value: " << (int)*node.fixed_value << std::endl;
-            return GetBestMoveFromFixedNode(node, random_engine);
-        }
-        ExpandTree(node, random_engine);
+    int it = 0;
+    for (; it < iterations && !node.fixed_value; ++it) {
+        TRACE_SCOPE(ITERATION);
+        env.trace.Clear();
+        ExpandTree(node, env);
+    }
+    return it;
+}
+
+Move SelectBestMove(const Node &node, const AiMctsConfig &config, random_engine_t &random_engine, bool verbose) {
+    if (node.fixed_value) {
+        if (verbose) std::cout << "(AI) Root node has fixed value: " << (int)*node.fixed_value << std::endl;
+        return GetBestMoveFromFixedNode(node, random_engine);
     }
     // Find the most-visited child node, and return the corresponding move.
     double expected_value = 0.0/0.0;  // for debug printing
@@ -389,68 +709,123 @@ Move GetBestMove(Node &node, random_engine_t &random_engine) {
     for (int i = 0; i < node.num_expanded; ++i) {
         int move = node.moves[i];
         const Node& child = *node.children[i];
-        if (child.visits > max_visits) {
+        // Moves that are proven worse than another one aren't candidates.
+        const bool dominated = BoundsForParent(node, child).second < node.pessimistic;
+        if (!dominated && child.visits > max_visits) {
             max_visits = child.visits;
             best_move = move;
-            if (debug_print_expected_value) {
+            if (verbose && config.debug_print_expected_value) {
                 expected_value = child.fixed_value ? GameValue(*child.fixed_value) :
                         1.0*(child.wins - child.losses)/child.visits;
             }
         }
-        if (debug_print_moves) {
+        if (verbose && config.debug_print_moves) {
             std::cout << "(AI) Move " << move << ": ";
             std::cout << '(' << child.wins << " - " << child.losses << ") / " << child.visits << '\n';
         }
     }
-    if (debug_print_moves) {
+    if (verbose && config.debug_print_moves) {
         for (int i = node.num_expanded; i < node.num_moves; ++i) {
             std::cout << "(AI) Move " << node.moves[i] << " unexpanded\n";
         }
     }
-    if (debug_print_expected_value) {
+    if (verbose && config.debug_print_expected_value) {
         if (node.est.next_piece < 0) expected_value = -expected_value;
         std::cout << "(AI) Expected value: "
                 << std::fixed << std::setprecision(3) << expected_value
                 << std::endl;
     }
+    if (best_move < 0) {
+        // Nothing was searched yet.
+        best_move = node.moves[RandomIndex(node.num_moves, random_engine)];
+    }
     return node.est.next_piece < 0 ? Move::Select(best_move) : Move::Place(best_move);
 }
 
+Move GetBestMove(Node &node, SearchEnv &env, bool verbose) {
+    RunSearch(node, env.config.iterations_per_move, env);
+    return SelectBestMove(node, env.config, env.random_engine, verbose);
+}
+
 }  // namespace
 
-AiMcts::AiMcts(const State &state) : state(state), random_engine(SeedRandomEngine()) {}
+SearchContext::SearchContext()
+        : pool(std::make_unique<ai_internal::NodePool>()), random_engine(SeedRandomEngine()) {}
+
+SearchContext::SearchContext(unsigned seed)
+        : pool(std::make_unique<ai_internal::NodePool>()), random_engine(seed) {}
+
+SearchContext::~SearchContext() = default;
+
+void SearchContext::Reserve(size_t nodes) { pool->Reserve(nodes); }
+
+size_t SearchContext::NodesInUse() const { return pool->InUse(); }
+
+size_t SearchContext::NodeCapacity() const { return pool->Capacity(); }
+
+AiMcts::AiMcts(const State &state, const AiMctsConfig &config)
+        : state(state), config(config), owned_context(std::make_unique<SearchContext>()),
+          context(*owned_context), random_engine(context.random_engine),
+          cache(std::make_unique<PositionCache>()),
+          pns(config.pns_visits > 0 ? std::make_unique<ProofNumberSearch>(config.pns_table_bits) : nullptr) {}
+
+AiMcts::AiMcts(const State &state, unsigned seed, const AiMctsConfig &config)
+        : state(state), config(config), owned_context(std::make_unique<SearchContext>(seed)),
+          context(*owned_context), random_engine(context.random_engine),
+          cache(std::make_unique<PositionCache>()),
+          pns(config.pns_visits > 0 ? std::make_unique<ProofNumberSearch>(config.pns_table_bits) : nullptr) {}
+
+AiMcts::AiMcts(const State &state, SearchContext &context, const AiMctsConfig &config)
+        : state(state), config(config), context(context), random_engine(context.random_engine),
+          cache(std::make_unique<PositionCache>()),
+          pns(config.pns_visits > 0 ? std::make_unique<ProofNumberSearch>(config.pns_table_bits) : nullptr) {}
 
 AiMcts::~AiMcts() = default;
 
+void AiMcts::Reset(const State &state) {
+    this->state = state;
+    root = nullptr;
+    cache->Clear();
+}
+
 bool AiMcts::Execute(Move move) {
     if (!state.Execute(move)) {
         return false;
     }
-
-    // Update `root` to selected child node, or reset it to nullptr if we don't
-    // have a matching expanded child (e.g. because the move was losing).
-    std::unique_ptr<Node> new_root = nullptr;
-    if (root && (
-            move.GetType() == Move::Type::SELECT ||
-            move.GetType() == Move::Type::PLACE)) {
-        int move_index =
-                std::find(
-                        root->moves.begin(),
-                        root->moves.begin() + root->num_expanded,
-                        move.GetType() == Move::Type::SELECT ?
-                                move.SelectedPiece() :
-                                move.PlacedField()) -
-                root->moves.begin();
-        if (move_index < root->num_expanded) {
-            new_root = std::move(root->children[move_index]);
-            assert(new_root);
-        }
+    if (!root) return true;
+    if (state.Over()) {
+        root = nullptr;
+        cache->Clear();
+        return true;
+    }
+    if (move.GetType() != Move::Type::SELECT && move.GetType() != Move::Type::PLACE) {
+        // Calling quarto is only valid when it wins, which ends the game, so
+        // passing is the only other move that gets here. It doesn't change
+        // the position, so the tree can be kept as it is.
+        return true;
     }
+
+    // Update `root` to the child node for the move. If the move is one that
+    // wasn't expanded yet, or was pruned because it loses, create the child.
+    const int m = move.GetType() == Move::Type::SELECT ? move.SelectedPiece() : move.PlacedField();
+    const int i = ExpandMove(*root, m, cache.get());
+    const Node *keep = i >= 0 ? root->children[i].get() : nullptr;
+
+    // Remember the statistics of the rest of the tree, which may contain the
+    // same positions as the remaining subtree.
+    cache->Harvest(*root, keep);
+    NodePtr new_root = i >= 0 ? std::move(root->children[i]) : context.pool->New(root->est, m);
     root = std::move(new_root);
+    cache->Prune(root->est);
+    if (i < 0) {
+        FixIfTerminal(*root);
+        cache->Seed(*root);
+    }
+    if (config.position_db) ApplyPrior(*root, *config.position_db, config.position_db_visits);
     return true;
 }
 
-Move AiMcts::CalculateMove() {
+std::optional<Move> AiMcts::ImmediateMove() {
     assert(!state.Over());
     if (state.IsQuartoPossible()) {
         return Move::Quarto();
@@ -462,12 +837,11 @@ Move AiMcts::CalculateMove() {
     if (next_action == NextAction::PLACE) {
         // See if we can place somewhere to win.
         std::vector<Move> winning_moves;
-        for (Move move : state.ListValidMoves()) {
-            State next_state = state;
-            next_state.ExecuteValid(move);
-            if (next_state.IsQuartoPossible()) {
-                std::cout << "(AI) Found winning move: place at " << move.PlacedField() << '\n';
-                winning_moves.push_back(move);
+        const EnhancedState &est = state.Enhanced();
+        for (int field = 0; field < 16; ++field) {
+            if (est.fields[field] < 0 && IsWinningPlacement(est, field)) {
+                if (verbose) std::cout << "(AI) Found winning move: place at " << field << '\n';
+                winning_moves.push_back(Move::Place(field));
             }
         }
         if (!winning_moves.empty()) {
@@ -476,13 +850,191 @@ Move AiMcts::CalculateMove() {
     }
 
     if (!root) {
-        std::cout << "(AI) Recreating root node...\n";
-        root = std::make_unique<ai_internal::Node>(EnhanceState(state));
+        if (verbose) std::cout << "(AI) Recreating root node...\n";
+        root = context.pool->New(state.Enhanced());
+        if (config.position_db) ApplyPrior(*root, *config.position_db, config.position_db_visits);
     }
     if (root->num_moves == 0) {
         // All moves are losing. Pick one at random.
-        std::cout << "(AI) Loss is imminent! :-(\n";
+        if (verbose) std::cout << "(AI) Loss is imminent! :-(\n";
         return RandomMove(state.ListValidMoves(), random_engine);
     }
-    return GetBestMove(*root, random_engine);
+    return std::nullopt;
+}
+
+bool AiMcts::Searchable() {
+    if (state.Over()) return false;
+    NextAction next_action = state.NextAction();
+    if (next_action != NextAction::SELECT && next_action != NextAction::PLACE) return false;
+    if (!root) {
+        root = context.pool->New(state.Enhanced());
+        if (config.position_db) ApplyPrior(*root, *config.position_db, config.position_db_visits);
+    }
+    return root->num_moves > 0;
+}
+
+int AiMcts::Search(int iterations) {
+    if (!Searchable()) return 0;
+    SearchEnv env{config, cache.get(), pns.get(), random_engine};
+    return RunSearch(*root, iterations, env);
+}
+
+std::optional<int> AiMcts::RootValue() const {
+    if (!root || !root->fixed_value) return std::nullopt;
+    return GameValue(*root->fixed_value);
+}
+
+std::vector<MoveStats> AiMcts::RootStats() const {
+    std::vector<MoveStats> result;
+    if (!root) return result;
+    for (int i = 0; i < root->num_expanded; ++i) {
+        const Node &child = *root->children[i];
+        MoveStats stats = {
+            root->est.next_piece < 0 ? Move::Select(root->moves[i]) : Move::Place(root->moves[i]),
+            child.visits, child.wins, child.losses, std::nullopt};
+        if (child.fixed_value) stats.fixed_value = GameValue(*child.fixed_value);
+        result.push_back(stats);
+    }
+    return result;
+}
+
+void AiMcts::MergeRootStats(const std::vector<MoveStats> &stats) {
+    if (!Searchable() || root->fixed_value) return;
+    Node &node = *root;
+    for (const MoveStats &s : stats) {
+        if (s.visits <= 0 && !s.fixed_value) continue;
+        int move = node.est.next_piece < 0 ? s.move.SelectedPiece() : s.move.PlacedField();
+        int i = move < 0 ? -1 : ExpandMove(node, move, cache.get());
+        if (i < 0) continue;  // not a (non-losing) move in this position
+        Node &child = *node.children[i];
+        node.visits += s.visits;
+        child.visits += s.visits;
+        if (child.fixed_value) continue;
+        if (s.fixed_value) {
+            child.Fix(static_cast<Result>(*s.fixed_value));
+        } else {
+            child.wins += s.wins;
+            child.losses += s.losses;
+        }
+    }
+    UpdateBounds(node);
+}
+
+Move AiMcts::BestMove() {
+    if (!Searchable()) return RandomMove(state.ListValidMoves(), random_engine);
+    return SelectBestMove(*root, config, random_engine, verbose);
+}
+
+std::optional<Move> AiMcts::BeginSearch() {
+    return ImmediateMove();
+}
+
+bool AiMcts::ContinueSearch(int iterations) {
+    SearchEnv env{config, cache.get(), pns.get(), random_engine};
+    RunSearch(*root, iterations, env);
+    return !root->fixed_value;
+}
+
+Move AiMcts::SearchResult() {
+    return SelectBestMove(*root, config, random_engine, false);
+}
+
+int64_t AiMcts::DefaultIterations() const {
+    return config.iterations_per_move;
+}
+
+Move AiMcts::CalculateMove() {
+    if (std::optional<Move> move = ImmediateMove()) {
+        return *move;
+    }
+    SearchEnv env{config, cache.get(), pns.get(), random_engine};
+    return GetBestMove(*root, env, verbose);
+}
+
+namespace {
+
+bool ParseValue(const std::string &value, double &result) {
+    char *end = nullptr;
+    result = strtod(value.c_str(), &end);
+    return !value.empty() && *end == '\0';
+}
+
+bool ParseValue(const std::string &value, int64_t &result) {
+    char *end = nullptr;
+    result = strtoll(value.c_str(), &end, 10);
+    return !value.empty() && *end == '\0';
+}
+
+bool ParseValue(const std::string &value, int &result) {
+    int64_t i;
+    if (!ParseValue(value, i) || i < INT_MIN || i > INT_MAX) return false;
+    result = i;
+    return true;
+}
+
+// Parses a number, which must be between `min` and `max`.
+template<class T>
+bool ParseValue(const std::string &value, T &result, T min, T max) {
+    T parsed;
+    if (!ParseValue(value, parsed) || !(parsed >= min && parsed <= max)) return false;
+    result = parsed;
+    return true;
+}
+
+bool ParseValue(const std::string &value, bool &result) {
+    if (value != "0" && value != "1" && value != "false" && value != "true") return false;
+    result = value == "1" || value == "true";
+    return true;
+}
+
+}  // namespace
+
+bool SetAiMctsParameter(AiMctsConfig &config, const std::string &name, const std::string &value) {
+    const double huge = std::numeric_limits<double>::max();
+    if (name == "exploration_factor") return ParseValue(value, config.exploration_factor, 0.0, huge);
+    if (name == "iterations_per_move") return ParseValue(value, config.iterations_per_move, 1, INT_MAX);
+    if (name == "debug_print_moves") return ParseValue(value, config.debug_print_moves);
+    if (name == "debug_print_expected_value") return ParseValue(value, config.debug_print_expected_value);
+    if (name == "playout_cutoff_depth") return ParseValue(value, config.playout_cutoff_depth, 0, INT_MAX);
+    if (name == "evaluation_weight") return ParseValue(value, config.evaluation_weight, 0.0, 1.0);
+    if (name == "pns_visits") return ParseValue(value, config.pns_visits, 0, INT_MAX);
+    if (name == "pns_max_nodes") return ParseValue(value, config.pns_max_nodes, int64_t(1), INT64_MAX);
+    // Entries are looked up in pairs, and 2^40 entries wouldn't fit in memory.
+    if (name == "pns_table_bits") return ParseValue(value, config.pns_table_bits, 1, 40);
+    if (name == "rave_equivalence") return ParseValue(value, config.rave_equivalence, 0.0, huge);
+    if (name == "position_db_visits") return ParseValue(value, config.position_db_visits, 0, INT_MAX);
+    return false;
+}
+
+bool ParseAiMctsConfig(const std::string &spec, AiMctsConfig &config) {
+    size_t begin = 0;
+    while (begin < spec.size()) {
+        size_t end = std::min(spec.find(',', begin), spec.size());
+        std::string item = spec.substr(begin, end - begin);
+        size_t eq = item.find('=');
+        if (eq == std::string::npos ||
+                !SetAiMctsParameter(config, item.substr(0, eq), item.substr(eq + 1))) {
+            return false;
+        }
+        begin = end + 1;
+    }
+    return true;
+}
+
+std::string FormatAiMctsConfig(const AiMctsConfig &config) {
+    std::ostringstream oss;
+    // Enough digits to parse back the same values.
+    oss << std::setprecision(std::numeric_limits<double>::max_digits10)
+        << "exploration_factor=" << config.exploration_factor
+        << ",iterations_per_move=" << config.iterations_per_move
+        << ",debug_print_moves=" << config.debug_print_moves
+        << ",debug_print_expected_value=" << config.debug_print_expected_value
+        << ",playout_cutoff_depth=" << config.playout_cutoff_depth
+        << ",evaluation_weight=" << config.evaluation_weight
+        << ",pns_visits=" << config.pns_visits
+        << ",pns_max_nodes=" << config.pns_max_nodes
+        << ",pns_table_bits=" << config.pns_table_bits
+        << ",rave_equivalence=" << config.rave_equivalence
+        << ",position_db_visits=" << config.position_db_visits;
+    return oss.str();
 }
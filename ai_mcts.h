@@ -5,25 +5,194 @@
 #include "ai.h"
 
 #include <memory>
+#include <optional>
 #include <random>
+#include <string>
+#include <vector>
+
+class PositionDatabase;
+class ProofNumberSearch;
 
 namespace ai_internal {
 class Node;
+class NodePool;
+class PositionCache;
 using random_engine_t = std::mt19937;
+
+// Returns a node to the pool it was allocated from.
+struct NodeDeleter {
+    void operator()(Node *node) const;
+};
+
+using NodePtr = std::unique_ptr<Node, NodeDeleter>;
 }  // namespace ai_internal
 
+// Parameters of the search.
+struct AiMctsConfig {
+    // Weight of the exploration term in the UCT formula.
+    double exploration_factor = 2;
+
+    // Number of search iterations run by CalculateMove().
+    int iterations_per_move = 1000000;
+
+    // Debug output printed with each move, if the AI is verbose: the
+    // statistics of each move from the root, and the expected value.
+    bool debug_print_moves = true;
+    bool debug_print_expected_value = true;
+
+    // If positive, playouts stop after this many placements and the outcome
+    // is estimated with a static evaluation instead of playing to the end.
+    int playout_cutoff_depth = 0;
+
+    // Scale of the static evaluation, between 0 and 1. Lower values make the
+    // estimated outcomes of cut-off playouts more likely to be ties.
+    double evaluation_weight = 0.5;
+
+    // If positive, a node is handed to proof-number search (see pns.h) when
+    // it's visited for this many times, which is a sign that it's a
+    // promising node. If its value is proven, the node gets a fixed value.
+    int pns_visits = 0;
+
+    // Number of nodes proof-number search may expand for each node.
+    int64_t pns_max_nodes = 10000;
+
+    // Size of the proof-number search table (2^bits entries).
+    int pns_table_bits = 18;
+
+    // If positive, the value of a move is blended with its all-moves-as-first
+    // (RAVE) value: how well the player did in all iterations in which they
+    // made the same move later on. The weight of that value decreases as the
+    // move gets more visits, and is one half after rave_equivalence
+    // visits. Unexpanded moves are also expanded in order of that value.
+    double rave_equivalence = 0;
+
+    // If set, the moves from the root are ordered by how often they were
+    // played in the database's games (see position_db.h), and the children
+    // for those moves start with the games' results as their statistics,
+    // counted as at most `position_db_visits` visits each (0 to only order).
+    const PositionDatabase *position_db = nullptr;
+    int position_db_visits = 100;
+};
+
+// Sets the parameter with the given name (as in AiMctsConfig, e.g.
+// "exploration_factor") to the given value. Returns false if the name is
+// unknown, or the value is malformed or out of range (e.g. negative counts, or
+// pns_table_bits outside 1..40). The position database can't be set this way.
+bool SetAiMctsParameter(AiMctsConfig &config, const std::string &name, const std::string &value);
+
+// Sets parameters from a comma-separated list of name=value pairs, as printed
+// by quarto-tune. Returns false if any of them is invalid.
+bool ParseAiMctsConfig(const std::string &spec, AiMctsConfig &config);
+
+// Formats all parameters that can be set by name, in the form accepted by
+// ParseAiMctsConfig().
+std::string FormatAiMctsConfig(const AiMctsConfig &config);
+
+// Search statistics for one of the moves from the root position. Values are
+// from the perspective of the player to move after the move is executed.
+struct MoveStats {
+    Move move;
+    int visits;
+    int wins, losses;
+    std::optional<int> fixed_value;  // -1, 0 or +1, if known
+};
+
+// Node memory and random number generator used by AiMcts.
+//
+// A context can be shared by many consecutive (but not concurrent) AIs, so
+// that short-lived AIs don't need to allocate a new tree and seed a new random
+// number generator each time. Freed nodes are kept for reuse, and their memory
+// is only released when the context is destroyed.
+class SearchContext {
+public:
+    // Seeds the random number generator from std::random_device.
+    SearchContext();
+    explicit SearchContext(unsigned seed);
+    ~SearchContext();
+
+    SearchContext(const SearchContext&) = delete;
+    SearchContext &operator=(const SearchContext&) = delete;
+
+    // Reseeds the random number generator, e.g. between games.
+    void Reset(unsigned seed) { random_engine.seed(seed); }
+
+    // Allocates memory for at least the given number of nodes in advance.
+    void Reserve(size_t nodes);
+
+    // Number of nodes currently in use, and the number there is memory for.
+    size_t NodesInUse() const;
+    size_t NodeCapacity() const;
+
+private:
+    friend class AiMcts;
+
+    std::unique_ptr<ai_internal::NodePool> pool;
+    ai_internal::random_engine_t random_engine;
+};
+
 class AiMcts : public Ai {
 public:
-    AiMcts(const State &state);
+    AiMcts(const State &state, const AiMctsConfig &config = AiMctsConfig());
+    AiMcts(const State &state, unsigned seed, const AiMctsConfig &config = AiMctsConfig());
+
+    // Uses the given context, which must outlive the AI.
+    AiMcts(const State &state, SearchContext &context, const AiMctsConfig &config = AiMctsConfig());
     ~AiMcts();
     bool Execute(Move move) override;
     Move CalculateMove() override;
 
+    // Discards the search tree and starts over from the given state.
+    void Reset(const State &state);
+
+    // Enables or disables debug output on stdout (enabled by default).
+    void SetVerbose(bool verbose) { this->verbose = verbose; }
+
+    // Number of search iterations run by CalculateMove().
+    int IterationsPerMove() const { return config.iterations_per_move; }
+
+    // Returns a move that can be chosen without searching: calling quarto,
+    // passing, an immediately winning placement, or a random move if all
+    // moves are losing.
+    std::optional<Move> ImmediateMove();
+
+    // Runs the given number of search iterations from the current position.
+    // Stops early if the value of the position becomes known. Returns the
+    // number of iterations run.
+    int Search(int iterations);
+
+    // Returns statistics for the expanded children of the root.
+    std::vector<MoveStats> RootStats() const;
+
+    // Returns the value of the current position for the player to move (-1, 0
+    // or +1), if the search has proven it.
+    std::optional<int> RootValue() const;
+
+    // Adds statistics gathered by an independent search of the same position.
+    void MergeRootStats(const std::vector<MoveStats> &stats);
+
+    // Returns the best move based on the search so far.
+    Move BestMove();
+
+protected:
+    std::optional<Move> BeginSearch() override;
+    bool ContinueSearch(int iterations) override;
+    Move SearchResult() override;
+    int64_t DefaultIterations() const override;
+
 private:
-    using random_t = std::mt19937;
+    // Creates the root node if necessary, and returns whether there is
+    // anything to search.
+    bool Searchable();
+
     State state;
-    std::unique_ptr<ai_internal::Node> root;
-    ai_internal::random_engine_t random_engine;
+    AiMctsConfig config;
+    std::unique_ptr<SearchContext> owned_context;  // unless given by the caller
+    SearchContext &context;
+    ai_internal::random_engine_t &random_engine;
+    std::unique_ptr<ai_internal::PositionCache> cache;
+    std::unique_ptr<ProofNumberSearch> pns;  // only in hybrid mode
+    ai_internal::NodePtr root;
+    bool verbose = true;
 };
 
 #endif /* ndef AI_MCTS_INCLUDED */
@@ -0,0 +1,143 @@
+#include "ai_parallel.h"
+
+#include <assert.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+struct AiParallel::Worker {
+    Placement placement;
+    unsigned seed;
+
+    // Only used on the worker's own thread, or while it's idle.
+    std::unique_ptr<SearchContext> context;
+    std::unique_ptr<AiMcts> ai;  // destroyed before the context
+    int64_t iterations = 0;      // in the last search
+
+    std::thread thread;
+};
+
+namespace {
+
+std::mt19937 SeedEngine() {
+    std::random_device dev;
+    std::seed_seq seed = {dev(), dev(), dev(), dev()};
+    return std::mt19937(seed);
+}
+
+}  // namespace
+
+AiParallel::AiParallel(const State &state, const AiMctsConfig &config, const ParallelConfig &parallel)
+        : state(state), config(config), parallel(parallel),
+          topology(parallel.topology ? *parallel.topology : SystemTopology()), seed_engine(SeedEngine()) {
+    for (int i = 0; i < std::max(1, parallel.threads); ++i) {
+        auto worker = std::make_unique<Worker>();
+        worker->placement = PlaceWorker(topology, parallel.affinity, i);
+        worker->seed = seed_engine();
+        workers.push_back(std::move(worker));
+    }
+    for (std::unique_ptr<Worker> &worker : workers) {
+        Worker *w = worker.get();
+        w->thread = std::thread([this, w]{ Work(*w); });
+    }
+    // Allocate each worker's memory on its own thread, after pinning it.
+    RunOnWorkers([this](Worker &worker) {
+        if (!worker.placement.cpus.empty()) PinCurrentThread(worker.placement.cpus);
+        worker.context = std::make_unique<SearchContext>(worker.seed);
+        if (this->parallel.reserve_nodes > 0) worker.context->Reserve(this->parallel.reserve_nodes);
+        worker.ai = std::make_unique<AiMcts>(this->state, *worker.context, this->config);
+        worker.ai->SetVerbose(false);
+    });
+}
+
+AiParallel::~AiParallel() {
+    RunOnWorkers([](Worker &worker) {
+        worker.ai = nullptr;
+        worker.context = nullptr;
+    });
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        shutting_down = true;
+    }
+    cv.notify_all();
+    for (std::unique_ptr<Worker> &worker : workers) worker->thread.join();
+}
+
+void AiParallel::RunOnWorkers(const std::function<void(Worker&)> &task) {
+    std::unique_lock<std::mutex> lock(mutex);
+    this->task = &task;
+    ++generation;
+    pending = workers.size();
+    cv.notify_all();
+    cv.wait(lock, [this]{ return pending == 0; });
+    this->task = nullptr;
+}
+
+void AiParallel::Work(Worker &worker) {
+    uint64_t done_generation = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        cv.wait(lock, [this, done_generation]{ return shutting_down || generation != done_generation; });
+        if (shutting_down) return;
+        done_generation = generation;
+        const std::function<void(Worker&)> &current = *task;
+        lock.unlock();
+        current(worker);
+        lock.lock();
+        if (--pending == 0) cv.notify_all();
+    }
+}
+
+bool AiParallel::Execute(Move move) {
+    if (!state.Execute(move)) return false;
+    combined = nullptr;
+    RunOnWorkers([move](Worker &worker) {
+        bool ok = worker.ai->Execute(move);
+        assert(ok);
+        (void)ok;
+    });
+    return true;
+}
+
+Move AiParallel::CalculateMove() {
+    // Combines the workers' statistics, without searching itself.
+    this->combined = std::make_unique<AiMcts>(state, seed_engine(), config);
+    AiMcts &combined = *this->combined;
+    combined.SetVerbose(false);
+    if (std::optional<Move> move = combined.ImmediateMove()) {
+        return *move;
+    }
+    const int iterations = combined.IterationsPerMove();
+    const auto start = std::chrono::steady_clock::now();
+    RunOnWorkers([iterations](Worker &worker) {
+        worker.iterations = worker.ai->Search(iterations);
+    });
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    throughput.clear();
+    for (size_t node = 0; node < std::max<size_t>(1, topology.nodes.size()); ++node) {
+        NodeThroughput t = {static_cast<int>(node), 0, 0, seconds};
+        for (const std::unique_ptr<Worker> &worker : workers) {
+            if (worker->placement.node != static_cast<int>(node)) continue;
+            ++t.workers;
+            t.iterations += worker->iterations;
+        }
+        if (t.workers > 0) throughput.push_back(t);
+    }
+    if (parallel.print_throughput) {
+        for (const NodeThroughput &t : throughput) {
+            std::cout << "(AI) Node " << t.node << ": " << t.workers << " threads, " << t.iterations
+                    << " iterations, " << std::fixed << std::setprecision(0)
+                    << t.IterationsPerSecond() << " iterations/s" << std::endl;
+        }
+    }
+
+    for (const std::unique_ptr<Worker> &worker : workers) {
+        combined.MergeRootStats(worker->ai->RootStats());
+    }
+    combined.SetVerbose(true);
+    return combined.BestMove();
+}
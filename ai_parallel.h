@@ -0,0 +1,94 @@
+#ifndef AI_PARALLEL_H_INCLUDED
+#define AI_PARALLEL_H_INCLUDED
+
+#include "quarto.h"
+#include "affinity.h"
+#include "ai.h"
+#include "ai_mcts.h"
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <vector>
+
+// Parameters of a parallel search.
+struct ParallelConfig {
+    // Number of worker threads.
+    int threads = 1;
+
+    // How the workers are pinned to the CPUs of the topology, which is
+    // SystemTopology() unless given.
+    Affinity affinity = Affinity::NODE;
+    std::optional<CpuTopology> topology;
+
+    // Number of tree nodes each worker allocates in advance.
+    size_t reserve_nodes = 0;
+
+    // Print the throughput of each NUMA node after each search.
+    bool print_throughput = true;
+};
+
+// Search work done by the workers of one NUMA node during the last search.
+struct NodeThroughput {
+    int node;
+    int workers;
+    int64_t iterations;
+    double seconds;  // wall-clock time of the search
+
+    double IterationsPerSecond() const { return seconds > 0 ? iterations / seconds : 0; }
+};
+
+// Spreads a search across threads in one process, like AiDistributed does
+// across processes: each worker runs an independent Monte Carlo search from
+// the current position with its own tree, and the statistics of the root's
+// children are combined to choose the move.
+//
+// Each worker thread is pinned (according to ParallelConfig::affinity) before
+// it creates its tree, and it's the only thread that allocates or frees the
+// tree's nodes, so the tree stays in the memory of the worker's NUMA node. The
+// trees are kept between moves.
+class AiParallel : public Ai {
+public:
+    AiParallel(const State &state, const AiMctsConfig &config = AiMctsConfig(),
+            const ParallelConfig &parallel = ParallelConfig());
+    ~AiParallel();
+    bool Execute(Move move) override;
+    Move CalculateMove() override;
+
+    // Throughput per node during the last search, for nodes with workers.
+    const std::vector<NodeThroughput> &Throughput() const { return throughput; }
+
+    // The combined statistics of the workers that the last move was chosen
+    // from, until the next move is executed (null before the first search).
+    const AiMcts *LastSearch() const { return combined.get(); }
+
+private:
+    struct Worker;
+
+    // Runs the task on every worker's thread, and waits until all are done.
+    void RunOnWorkers(const std::function<void(Worker&)> &task);
+    void Work(Worker &worker);
+
+    State state;
+    AiMctsConfig config;
+    ParallelConfig parallel;
+    const CpuTopology topology;
+    std::mt19937 seed_engine;
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<NodeThroughput> throughput;
+    std::unique_ptr<AiMcts> combined;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    const std::function<void(Worker&)> *task = nullptr;
+    uint64_t generation = 0;  // incremented for each task
+    int pending = 0;          // workers still running the task
+    bool shutting_down = false;
+};
+
+#endif /* ndef AI_PARALLEL_H_INCLUDED */
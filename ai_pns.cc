@@ -0,0 +1,44 @@
+#include "ai_pns.h"
+
+#include <assert.h>
+
+#include <iostream>
+
+AiPns::AiPns(const State &state) : AiPns(state, Options()) {}
+
+AiPns::AiPns(const State &state, const Options &options)
+        : state(state), options(options), pns(options.table_bits),
+          fallback(state, options.fallback_config) {}
+
+void AiPns::SetVerbose(bool verbose) {
+    this->verbose = verbose;
+    fallback.SetVerbose(verbose);
+}
+
+bool AiPns::Execute(Move move) {
+    if (!state.Execute(move)) return false;
+    bool ok = fallback.Execute(move);
+    assert(ok);
+    return ok;
+}
+
+Move AiPns::CalculateMove() {
+    if (std::optional<Move> move = fallback.ImmediateMove()) {
+        return *move;
+    }
+    const EnhancedState &est = state.Enhanced();
+    const int64_t start_nodes = pns.Nodes();
+    std::optional<int> value = pns.Solve(est, options.max_nodes);
+    if (verbose) {
+        std::cout << "(AI) Proof-number search expanded " << pns.Nodes() - start_nodes << " nodes: ";
+        if (value) std::cout << "value is " << *value << '\n'; else std::cout << "no proof\n";
+    }
+    if (value && *value >= 0) {
+        int move = pns.ProvingMove(est,
+                *value > 0 ? ProofNumberSearch::Goal::WIN : ProofNumberSearch::Goal::NON_LOSS);
+        if (move >= 0) return est.next_piece < 0 ? Move::Select(move) : Move::Place(move);
+    }
+    // Either the position is lost (and the search picks the move most likely
+    // to make the opponent go wrong) or we don't know its value.
+    return fallback.CalculateMove();
+}
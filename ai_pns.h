@@ -0,0 +1,38 @@
+#ifndef AI_PNS_H_INCLUDED
+#define AI_PNS_H_INCLUDED
+
+#include "quarto.h"
+#include "ai.h"
+#include "ai_mcts.h"
+#include "pns.h"
+
+// Plays moves that proof-number search proves to win, or to tie when a win is
+// impossible. If the position can't be solved within the budget, or it is
+// lost, the move is chosen by Monte Carlo tree search instead.
+class AiPns : public Ai {
+public:
+    struct Options {
+        int table_bits = 22;
+        int64_t max_nodes = 2000000;  // per move
+
+        // Parameters of the Monte Carlo search used as a fallback.
+        AiMctsConfig fallback_config;
+    };
+
+    explicit AiPns(const State &state);
+    AiPns(const State &state, const Options &options);
+    bool Execute(Move move) override;
+    Move CalculateMove() override;
+
+    // Enables or disables debug output on stdout (enabled by default).
+    void SetVerbose(bool verbose);
+
+private:
+    State state;
+    Options options;
+    ProofNumberSearch pns;
+    AiMcts fallback;
+    bool verbose = true;
+};
+
+#endif /* ndef AI_PNS_H_INCLUDED */
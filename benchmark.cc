@@ -0,0 +1,311 @@
+// Measures how quickly the engines solve a set of positions with known values
+// and best moves.
+//
+// Usage: quarto-bench [<options>]
+//
+// For each position and engine configuration, this reports how many
+// iterations (and how much time) the search needed to settle on a best move,
+// and to prove the value of the root. Unlike micro-benchmarks, this tracks
+// whether the search as a whole gets better or worse with each change.
+
+#include "quarto.h"
+#include "ai_mcts.h"
+#include "enhanced_state.h"
+#include "notation.h"
+#include "pns.h"
+#include "solver.h"
+#include "trace.h"
+
+#include <stdlib.h>
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Position {
+    std::string compact;
+    State state;
+    int value;
+    std::string best_moves;  // compactly encoded
+};
+
+struct Options {
+    std::string positions = "benchmark-positions.txt";
+    std::vector<std::string> configs = {"mcts", "cutoff", "rave", "hybrid", "pns", "solver"};
+    int64_t iterations = 1000000;
+    int slice = 1000;
+    unsigned seed = 1;
+    std::string trace;
+};
+
+// Time and work needed to reach a milestone, if it was reached.
+struct Milestone {
+    bool reached = false;
+    int64_t work = 0;  // iterations or nodes
+    double seconds = 0;
+};
+
+struct Result {
+    Milestone move;   // settled on a best move
+    Milestone proof;  // proved the value
+    bool wrong_value = false;
+    double seconds = 0;  // total
+};
+
+class Timer {
+public:
+    double Seconds() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+private:
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+};
+
+bool LoadPositions(const std::string &path, std::vector<Position> &positions) {
+    std::ifstream is(path);
+    if (!is) {
+        std::cerr << "Could not open " << path << std::endl;
+        return false;
+    }
+    std::string line;
+    for (int line_number = 1; std::getline(is, line); ++line_number) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream iss(line);
+        std::string compact, best_moves;
+        int value = 0;
+        if (!(iss >> compact)) continue;
+        std::optional<State> state = DecodeState(compact == "-" ? "" : compact);
+        if (!(iss >> value >> best_moves) || !state || state->Over()) {
+            std::cerr << path << ':' << line_number << ": invalid position" << std::endl;
+            return false;
+        }
+        positions.push_back(Position{compact, *state, value, best_moves});
+    }
+    return true;
+}
+
+bool IsBestMove(const Position &position, Move move) {
+    return position.best_moves.find(EncodeMove(move)) != std::string::npos;
+}
+
+Result RunMcts(const Position &position, const AiMctsConfig &config, const Options &options) {
+    Result result;
+    AiMcts ai(position.state, options.seed, config);
+    ai.SetVerbose(false);
+    Timer timer;
+    std::shared_ptr<SearchHandle> search = ai.PrepareSearch(SearchBudget{options.iterations});
+    // The move counts as found at the first slice after which the search
+    // didn't change its mind anymore.
+    auto check_move = [&](std::optional<Move> move) {
+        if (move && IsBestMove(position, *move)) {
+            if (!result.move.reached) {
+                result.move = Milestone{true, search->Iterations(), timer.Seconds()};
+            }
+        } else {
+            result.move = Milestone();
+        }
+    };
+    while (search->RunSlice(options.slice)) check_move(search->BestMove());
+    check_move(search->Wait());
+    result.seconds = timer.Seconds();
+    if (std::optional<int> value = ai.RootValue()) {
+        result.proof = Milestone{true, search->Iterations(), timer.Seconds()};
+        result.wrong_value = *value != position.value;
+    }
+    return result;
+}
+
+Result RunPns(const Position &position, const Options &options) {
+    Result result;
+    const EnhancedState &est = position.state.Enhanced();
+    ProofNumberSearch pns(22);
+    Timer timer;
+    std::optional<int> value = pns.Solve(est, options.iterations);
+    result.seconds = timer.Seconds();
+    if (!value) return result;
+    result.proof = Milestone{true, pns.Nodes(), timer.Seconds()};
+    result.wrong_value = *value != position.value;
+    if (*value >= 0) {
+        int m = pns.ProvingMove(est,
+                *value > 0 ? ProofNumberSearch::Goal::WIN : ProofNumberSearch::Goal::NON_LOSS);
+        Move move = est.next_piece < 0 ? Move::Select(m) : Move::Place(m);
+        if (m >= 0 && IsBestMove(position, move)) result.move = result.proof;
+    }
+    return result;
+}
+
+Result RunSolver(const Position &position) {
+    Result result;
+    Solver::Options solver_options;
+    Solver solver(solver_options);
+    Timer timer;
+    const EnhancedState &est = position.state.Enhanced();
+    int value = solver.Solve(est);
+    result.proof = Milestone{true, solver.Nodes(), timer.Seconds()};
+    result.wrong_value = value != position.value;
+    // The solver plays the first move that achieves the value, which mostly
+    // takes table lookups after solving.
+    for (Move move : position.state.ListValidMoves()) {
+        bool select = move.GetType() == Move::Type::SELECT;
+        if (!select && move.GetType() != Move::Type::PLACE) continue;
+        if (solver.SolveMove(est, select ? move.SelectedPiece() : move.PlacedField()) == value) {
+            if (IsBestMove(position, move)) result.move = Milestone{true, solver.Nodes(), timer.Seconds()};
+            break;
+        }
+    }
+    result.seconds = timer.Seconds();
+    return result;
+}
+
+bool RunConfig(const std::string &config, const Position &position, const Options &options, Result &result) {
+    AiMctsConfig mcts_config;
+    if (config == "mcts") {
+        result = RunMcts(position, mcts_config, options);
+    } else if (config == "cutoff") {
+        mcts_config.playout_cutoff_depth = 4;
+        result = RunMcts(position, mcts_config, options);
+    } else if (config == "rave") {
+        mcts_config.rave_equivalence = 100;
+        result = RunMcts(position, mcts_config, options);
+    } else if (config == "hybrid") {
+        mcts_config.pns_visits = 1000;
+        result = RunMcts(position, mcts_config, options);
+    } else if (config == "pns") {
+        result = RunPns(position, options);
+    } else if (config == "solver") {
+        result = RunSolver(position);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+std::string Describe(const Milestone &milestone) {
+    std::ostringstream oss;
+    if (milestone.reached) {
+        oss << std::setw(9) << milestone.work << " " << std::fixed << std::setprecision(3)
+                << std::setw(8) << milestone.seconds << " s";
+    } else {
+        oss << std::setw(9) << "-" << std::setw(10) << "";
+    }
+    return oss.str();
+}
+
+struct Totals {
+    int moves_found = 0, proofs_found = 0, wrong_values = 0;
+    double seconds = 0;
+};
+
+void PrintUsage(std::ostream &os) {
+    os << "Usage: quarto-bench [<options>]\n"
+        "\n"
+        "Options:\n"
+        "  --positions=<file>     positions to solve (default: benchmark-positions.txt)\n"
+        "  --configs=<list>       comma-separated engine configurations to measure, out of\n"
+        "                         mcts, cutoff, rave, hybrid, pns and solver (default:\n"
+        "                         all)\n"
+        "  --iterations=<count>   search budget per position, in iterations for Monte\n"
+        "                         Carlo search or nodes for proof-number search\n"
+        "                         (default: 1000000)\n"
+        "  --slice=<iterations>   iterations between checks of the best move (default: 1000)\n"
+        "  --seed=<seed>          random seed for the searches (default: 1)\n"
+        "  --trace=<file>         write a trace of the search phases in Chrome trace\n"
+        "                         format (requires building with make TRACING=1)\n";
+}
+
+bool ParseOption(const std::string &arg, const std::string &name, std::string &value) {
+    std::string prefix = "--" + name + "=";
+    if (arg.compare(0, prefix.size(), prefix) != 0) return false;
+    value = arg.substr(prefix.size());
+    return true;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        std::string value;
+        if (ParseOption(arg, "positions", value)) {
+            options.positions = value;
+        } else if (ParseOption(arg, "configs", value)) {
+            options.configs.clear();
+            std::istringstream iss(value);
+            for (std::string config; std::getline(iss, config, ','); ) options.configs.push_back(config);
+        } else if (ParseOption(arg, "iterations", value)) {
+            options.iterations = std::max(1LL, atoll(value.c_str()));
+        } else if (ParseOption(arg, "slice", value)) {
+            options.slice = std::max(1, atoi(value.c_str()));
+        } else if (ParseOption(arg, "seed", value)) {
+            options.seed = strtoul(value.c_str(), nullptr, 10);
+        } else if (ParseOption(arg, "trace", value)) {
+            options.trace = value;
+        } else if (arg == "-h" || arg == "--help") {
+            PrintUsage(std::cout);
+            return 0;
+        } else {
+            std::cerr << "Unexpected argument: " << arg << '\n';
+            PrintUsage(std::cerr);
+            return 1;
+        }
+    }
+    if (!options.trace.empty()) {
+        if (!tracing::Available()) {
+            std::cerr << "Tracing is not available. Rebuild with make TRACING=1." << std::endl;
+            return 1;
+        }
+        tracing::Enable(true);
+    }
+    std::vector<Position> positions;
+    if (!LoadPositions(options.positions, positions)) return 1;
+
+    std::cout << std::left << std::setw(24) << "position" << std::setw(8) << "config"
+            << std::right << std::setw(19) << "best move" << std::setw(19) << "proof" << '\n';
+    std::vector<Totals> totals(options.configs.size());
+    for (const Position &position : positions) {
+        for (size_t c = 0; c < options.configs.size(); ++c) {
+            Result result;
+            tracing::Mark(position.compact + " " + options.configs[c]);
+            if (!RunConfig(options.configs[c], position, options, result)) {
+                std::cerr << "Unknown configuration: " << options.configs[c] << std::endl;
+                return 1;
+            }
+            std::cout << std::left << std::setw(24) << position.compact << std::setw(8)
+                    << options.configs[c] << std::right << Describe(result.move)
+                    << Describe(result.proof) << (result.wrong_value ? "  WRONG VALUE" : "")
+                    << std::endl;
+            Totals &t = totals[c];
+            t.moves_found += result.move.reached;
+            t.proofs_found += result.proof.reached;
+            t.wrong_values += result.wrong_value;
+            t.seconds += result.seconds;
+        }
+    }
+
+    std::cout << '\n';
+    bool ok = true;
+    for (size_t c = 0; c < options.configs.size(); ++c) {
+        const Totals &t = totals[c];
+        std::cout << std::left << std::setw(8) << options.configs[c] << std::right
+                << std::setw(3) << t.moves_found << '/' << positions.size() << " best moves, "
+                << std::setw(3) << t.proofs_found << '/' << positions.size() << " proofs, "
+                << std::fixed << std::setprecision(3) << t.seconds << " s";
+        if (t.wrong_values > 0) std::cout << ", " << t.wrong_values << " WRONG VALUES";
+        std::cout << '\n';
+        ok = ok && t.wrong_values == 0;
+    }
+    if (!options.trace.empty()) {
+        std::cout << '\n';
+        tracing::WriteSummary(std::cout);
+        if (!tracing::WriteChromeTrace(options.trace)) return 1;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,490 @@
+// Builds and queries position statistics databases (see position_db.h).
+//
+// Usage:
+//   quarto-db --build=<db> [<options>] <games>...
+//   quarto-db --query=<position> <db>
+//
+// Game files contain one game per line, as a compact move string. Every
+// position reached in a finished game is canonicalized and counted.
+//
+// Building is an external sort: worker threads replay games and sort the
+// positions they see in memory, and write them to temporary run files when
+// their share of the memory is full. The runs are then merged (in parallel, if
+// there are many) into the final database, combining the statistics of equal
+// positions along the way.
+
+#include "quarto.h"
+#include "notation.h"
+#include "position_db.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Options {
+    std::string build;
+    std::optional<std::string> query;
+    std::vector<std::string> inputs;
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t memory_mb = 1024;
+    std::string temp_dir = ".";
+};
+
+// A single occurrence of a canonical position in a game. Much smaller than a
+// PositionStatsRecord, so that more of them fit in memory before sorting.
+struct Observation {
+    uint64_t board;
+    uint16_t occupied;
+    int8_t next_piece;
+    int8_t result;  // for the player to move
+    uint8_t move;   // canonical
+    uint8_t padding[3];
+
+    PositionKey Key() const { return PositionKey{board, occupied, next_piece}; }
+    bool operator<(const Observation &o) const { return Key() < o.Key(); }
+};
+
+static_assert(sizeof(Observation) == 16);
+
+void AddSaturated(uint32_t &into, uint32_t value) {
+    into = into > UINT32_MAX - value ? UINT32_MAX : into + value;
+}
+
+// Adds the statistics of `record` to `into`, which has the same key.
+void Combine(PositionStatsRecord &into, const PositionStatsRecord &record) {
+    AddSaturated(into.games, record.games);
+    AddSaturated(into.wins, record.wins);
+    AddSaturated(into.draws, record.draws);
+    for (int i = 0; i < 16; ++i) AddSaturated(into.moves[i], record.moves[i]);
+}
+
+PositionStatsRecord ToRecord(const Observation &o) {
+    PositionStatsRecord record = {};
+    record.board = o.board;
+    record.occupied = o.occupied;
+    record.next_piece = o.next_piece;
+    record.games = 1;
+    record.wins = o.result > 0;
+    record.draws = o.result == 0;
+    record.moves[o.move] = 1;
+    return record;
+}
+
+// Sequential, buffered writer of records.
+class RecordWriter {
+public:
+    RecordWriter(const std::string &path) : path(path), file(fopen(path.c_str(), "wb")) {
+        if (!file) perror(path.c_str());
+        else setvbuf(file, nullptr, _IOFBF, 1 << 20);
+    }
+    ~RecordWriter() { Close(); }
+
+    bool Ok() const { return ok; }
+
+    void Write(const void *data, size_t size) {
+        if (ok && fwrite(data, size, 1, file) != 1) {
+            perror(path.c_str());
+            ok = false;
+        }
+    }
+    void Write(const PositionStatsRecord &record) { Write(&record, sizeof(record)); }
+
+    // Returns whether everything was written successfully.
+    bool Close() {
+        if (file) {
+            if (fclose(file) != 0 && ok) {
+                perror(path.c_str());
+                ok = false;
+            }
+            file = nullptr;
+        }
+        return ok;
+    }
+
+private:
+    std::string path;
+    FILE *file;
+    bool ok = file != nullptr;
+};
+
+// Sequential, buffered reader of records.
+class RecordReader {
+public:
+    RecordReader(const std::string &path) : file(fopen(path.c_str(), "rb")) {
+        if (!file) perror(path.c_str());
+        else setvbuf(file, nullptr, _IOFBF, 1 << 20);
+    }
+    ~RecordReader() { if (file) fclose(file); }
+
+    bool Ok() const { return file != nullptr; }
+
+    // Reads the next record, and returns false at the end of the file.
+    bool Next(PositionStatsRecord &record) {
+        return file && fread(&record, sizeof(record), 1, file) == 1;
+    }
+
+private:
+    FILE *file;
+};
+
+// Batches of games, passed from the reading thread to the workers.
+class GameQueue {
+public:
+    explicit GameQueue(size_t max_batches) : max_batches(max_batches) {}
+
+    void Push(std::vector<std::string> batch) {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_full.wait(lock, [this]{ return batches.size() < max_batches; });
+        batches.push_back(std::move(batch));
+        not_empty.notify_one();
+    }
+
+    // Returns false when the queue is closed and empty.
+    bool Pop(std::vector<std::string> &batch) {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_empty.wait(lock, [this]{ return closed || !batches.empty(); });
+        if (batches.empty()) return false;
+        batch = std::move(batches.front());
+        batches.pop_front();
+        not_full.notify_one();
+        return true;
+    }
+
+    void Close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        not_empty.notify_all();
+    }
+
+private:
+    const size_t max_batches;
+    std::mutex mutex;
+    std::condition_variable not_empty, not_full;
+    std::deque<std::vector<std::string>> batches;
+    bool closed = false;
+};
+
+class Builder {
+public:
+    explicit Builder(const Options &options) : options(options) {}
+
+    bool Build();
+
+private:
+    static constexpr size_t batch_size = 1024;
+    static constexpr size_t max_fan_in = 64;
+
+    bool ReadGames(GameQueue &queue);
+    void ReplayGames(GameQueue &queue);
+    bool Replay(const std::string &game, std::vector<Observation> &observations);
+    void WriteRun(std::vector<Observation> &observations);
+    bool Merge(const std::vector<std::string> &inputs, const std::string &output, bool with_header);
+    std::string NewRunPath();
+
+    const Options &options;
+    std::atomic<uint64_t> games{0}, invalid_games{0}, unfinished_games{0}, positions{0};
+    std::atomic<int> next_run{0};
+    std::atomic<bool> failed{false};
+    std::mutex runs_mutex;
+    std::vector<std::string> runs;
+};
+
+std::string Builder::NewRunPath() {
+    return options.temp_dir + "/quarto-db." + std::to_string(getpid()) + "." +
+            std::to_string(next_run++) + ".run";
+}
+
+bool Builder::ReadGames(GameQueue &queue) {
+    std::vector<std::string> batch;
+    for (const std::string &path : options.inputs) {
+        std::ifstream file;
+        if (path != "-") {
+            file.open(path);
+            if (!file) {
+                std::cerr << "Could not open " << path << std::endl;
+                return false;
+            }
+        }
+        std::istream &is = path == "-" ? std::cin : file;
+        std::string line;
+        while (std::getline(is, line)) {
+            size_t begin = line.find_first_not_of(" \t\r");
+            if (begin == std::string::npos || line[begin] == '#') continue;
+            size_t end = line.find_first_of(" \t\r#", begin);
+            batch.push_back(line.substr(begin, end - begin));
+            if (batch.size() == batch_size) {
+                queue.Push(std::move(batch));
+                batch.clear();
+            }
+        }
+    }
+    if (!batch.empty()) queue.Push(std::move(batch));
+    return true;
+}
+
+// Replays a game, and appends an observation for each position in which a
+// piece was selected or placed. Returns false if the game is invalid or
+// unfinished, in which case nothing is appended.
+bool Builder::Replay(const std::string &game, std::vector<Observation> &observations) {
+    State state = State::Initial();
+    std::array<Observation, 32> seen;
+    std::array<int, 32> players;
+    int num_seen = 0;
+    for (char ch : game) {
+        std::optional<Move> move = DecodeMove(ch);
+        if (!move || !state.IsValid(*move)) {
+            ++invalid_games;
+            return false;
+        }
+        if (move->GetType() == Move::Type::SELECT || move->GetType() == Move::Type::PLACE) {
+            const EnhancedState &est = state.Enhanced();
+            int m = move->GetType() == Move::Type::SELECT ? move->SelectedPiece() : move->PlacedField();
+            Symmetry symmetry;
+            PositionKey key = CanonicalKey(est, &symmetry);
+            int canonical_move = est.next_piece < 0 ? symmetry.MapPiece(m) : symmetry.MapField(m);
+            seen[num_seen] = Observation{key.board, key.occupied, key.next_piece, 0,
+                    uint8_t(canonical_move), {}};
+            players[num_seen++] = state.NextPlayer();
+        }
+        state.ExecuteValid(*move);
+    }
+    if (!state.Over()) {
+        ++unfinished_games;
+        return false;
+    }
+    const int winner = state.Winner();
+    for (int i = 0; i < num_seen; ++i) {
+        seen[i].result = winner < 0 ? 0 : winner == players[i] ? 1 : -1;
+        observations.push_back(seen[i]);
+    }
+    ++games;
+    positions += num_seen;
+    return true;
+}
+
+// Sorts the observations, and writes them to a new run with the statistics of
+// equal positions combined.
+void Builder::WriteRun(std::vector<Observation> &observations) {
+    if (observations.empty()) return;
+    std::sort(observations.begin(), observations.end());
+    std::string path = NewRunPath();
+    RecordWriter writer(path);
+    PositionStatsRecord record = ToRecord(observations[0]);
+    for (size_t i = 1; i < observations.size(); ++i) {
+        PositionStatsRecord next = ToRecord(observations[i]);
+        if (next.Key() == record.Key()) {
+            Combine(record, next);
+        } else {
+            writer.Write(record);
+            record = next;
+        }
+    }
+    writer.Write(record);
+    observations.clear();
+    if (!writer.Close()) failed = true;
+    std::lock_guard<std::mutex> lock(runs_mutex);
+    runs.push_back(path);
+}
+
+void Builder::ReplayGames(GameQueue &queue) {
+    const size_t capacity = std::max<size_t>(
+            options.memory_mb * (1 << 20) / options.threads / sizeof(Observation), 1024);
+    std::vector<Observation> observations;
+    observations.reserve(capacity);
+    std::vector<std::string> batch;
+    while (queue.Pop(batch)) {
+        for (const std::string &game : batch) {
+            // A game adds at most 32 observations.
+            if (observations.size() + 32 > capacity) WriteRun(observations);
+            Replay(game, observations);
+        }
+    }
+    WriteRun(observations);
+}
+
+// Merges sorted runs into one, combining the statistics of equal positions.
+bool Builder::Merge(const std::vector<std::string> &inputs, const std::string &output, bool with_header) {
+    std::vector<std::unique_ptr<RecordReader>> readers;
+    for (const std::string &path : inputs) {
+        readers.push_back(std::make_unique<RecordReader>(path));
+        if (!readers.back()->Ok()) return false;
+    }
+    RecordWriter writer(output);
+    if (with_header) writer.Write(&position_db_header, sizeof(position_db_header));
+
+    // Heap of the next record from each reader, smallest key first.
+    using Head = std::pair<PositionStatsRecord, size_t>;
+    auto greater = [](const Head &a, const Head &b) { return b.first.Key() < a.first.Key(); };
+    std::priority_queue<Head, std::vector<Head>, decltype(greater)> heads(greater);
+    for (size_t i = 0; i < readers.size(); ++i) {
+        PositionStatsRecord record;
+        if (readers[i]->Next(record)) heads.emplace(record, i);
+    }
+    std::optional<PositionStatsRecord> current;
+    while (!heads.empty()) {
+        auto [record, i] = heads.top();
+        heads.pop();
+        if (current && current->Key() == record.Key()) {
+            Combine(*current, record);
+        } else {
+            if (current) writer.Write(*current);
+            current = record;
+        }
+        if (readers[i]->Next(record)) heads.emplace(record, i);
+    }
+    if (current) writer.Write(*current);
+    return writer.Close();
+}
+
+bool Builder::Build() {
+    GameQueue queue(2*options.threads);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < options.threads; ++i) {
+        workers.emplace_back([this, &queue]{ ReplayGames(queue); });
+    }
+    bool read_ok = ReadGames(queue);
+    queue.Close();
+    for (std::thread &worker : workers) worker.join();
+    std::cerr << games << " games, " << positions << " positions, " << runs.size() << " runs";
+    if (invalid_games > 0) std::cerr << ", " << invalid_games << " invalid games skipped";
+    if (unfinished_games > 0) std::cerr << ", " << unfinished_games << " unfinished games skipped";
+    std::cerr << std::endl;
+
+    // Merge groups of runs in parallel, until few enough are left to merge
+    // them all at once.
+    while (read_ok && !failed && runs.size() > max_fan_in) {
+        std::vector<std::vector<std::string>> groups;
+        for (size_t i = 0; i < runs.size(); i += max_fan_in) {
+            groups.emplace_back(runs.begin() + i, runs.begin() + std::min(i + max_fan_in, runs.size()));
+        }
+        std::vector<std::string> merged(groups.size());
+        std::atomic<size_t> next_group{0};
+        std::vector<std::thread> mergers;
+        for (int t = 0; t < options.threads && t < (int) groups.size(); ++t) {
+            mergers.emplace_back([&]{
+                for (size_t g; (g = next_group++) < groups.size(); ) {
+                    merged[g] = NewRunPath();
+                    if (!Merge(groups[g], merged[g], false)) failed = true;
+                    for (const std::string &path : groups[g]) remove(path.c_str());
+                }
+            });
+        }
+        for (std::thread &merger : mergers) merger.join();
+        runs = merged;
+    }
+
+    // Write to a temporary file first, so that a failed build doesn't leave a
+    // truncated database behind.
+    bool ok = read_ok && !failed;
+    if (ok) {
+        const std::string temp = options.build + ".tmp";
+        ok = Merge(runs, temp, true) && rename(temp.c_str(), options.build.c_str()) == 0;
+        if (!ok) remove(temp.c_str());
+    }
+    for (const std::string &path : runs) remove(path.c_str());
+    return ok;
+}
+
+int Query(const std::string &path, const std::string &compact) {
+    PositionDatabase db(path);
+    if (!db.Ok()) return 1;
+    std::optional<State> state = DecodeState(compact == "-" ? "" : compact);
+    if (!state) {
+        std::cerr << "Invalid position: " << compact << std::endl;
+        return 1;
+    }
+    NextAction next_action = state->NextAction();
+    if (next_action != NextAction::SELECT && next_action != NextAction::PLACE) {
+        std::cerr << "No piece to select or place in this position." << std::endl;
+        return 1;
+    }
+    std::optional<PositionStats> stats = db.Lookup(state->Enhanced());
+    if (!stats) {
+        std::cout << "Position not found.\n";
+        return 0;
+    }
+    std::cout << stats->games << " games, " << stats->wins << " wins, " << stats->draws << " draws, "
+            << stats->Losses() << " losses for the player to move\n";
+    for (int m = 0; m < 16; ++m) {
+        if (stats->moves[m] == 0) continue;
+        Move move = next_action == NextAction::SELECT ? Move::Select(m) : Move::Place(m);
+        std::cout << EncodeMove(move) << ' ' << std::setw(10) << stats->moves[m] << '\n';
+    }
+    return 0;
+}
+
+void PrintUsage(std::ostream &os) {
+    os << "Usage:\n"
+        "  quarto-db --build=<db> [<options>] <games>...\n"
+        "  quarto-db --query=<position> <db>\n"
+        "\n"
+        "Builds a position statistics database from files with one compactly\n"
+        "encoded game per line (- for standard input), or looks up a position.\n"
+        "\n"
+        "Options:\n"
+        "  --threads=<count>   number of threads (default: number of CPUs)\n"
+        "  --memory=<MiB>      memory for sorting positions (default: 1024)\n"
+        "  --temp-dir=<dir>    directory for temporary files (default: .)\n";
+}
+
+bool ParseOption(const std::string &arg, const std::string &name, std::string &value) {
+    std::string prefix = "--" + name + "=";
+    if (arg.compare(0, prefix.size(), prefix) != 0) return false;
+    value = arg.substr(prefix.size());
+    return true;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        std::string value;
+        if (ParseOption(arg, "build", value)) {
+            options.build = value;
+        } else if (ParseOption(arg, "query", value)) {
+            options.query = value;
+        } else if (ParseOption(arg, "threads", value)) {
+            options.threads = std::max(1, atoi(value.c_str()));
+        } else if (ParseOption(arg, "memory", value)) {
+            options.memory_mb = std::max(1LL, atoll(value.c_str()));
+        } else if (ParseOption(arg, "temp-dir", value)) {
+            options.temp_dir = value;
+        } else if (arg == "-h" || arg == "--help") {
+            PrintUsage(std::cout);
+            return 0;
+        } else if (arg == "-" || arg.compare(0, 2, "--") != 0) {
+            options.inputs.push_back(arg);
+        } else {
+            std::cerr << "Unexpected argument: " << arg << '\n';
+            PrintUsage(std::cerr);
+            return 1;
+        }
+    }
+    if (options.query && options.build.empty() && options.inputs.size() == 1) {
+        return Query(options.inputs[0], *options.query);
+    }
+    if (options.build.empty() || options.query || options.inputs.empty()) {
+        PrintUsage(std::cerr);
+        return 1;
+    }
+    Builder builder(options);
+    return builder.Build() ? 0 : 1;
+}
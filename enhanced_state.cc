@@ -0,0 +1,19 @@
+#include "enhanced_state.h"
+
+const signed char lines_per_field[16][4] = {
+    {0, 4, 8, -1},
+    {0, 5, -1},
+    {0, 6, -1},
+    {0, 7, 9, -1},
+    {1, 4, -1},
+    {1, 5, 8, -1},
+    {1, 6, 9, -1},
+    {1, 7, -1},
+    {2, 4, -1},
+    {2, 5, 9, -1},
+    {2, 6, 8, -1},
+    {2, 7, -1},
+    {3, 4, 9, -1},
+    {3, 5, -1},
+    {3, 6, -1},
+    {3, 7, 8, -1}};
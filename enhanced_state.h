@@ -0,0 +1,116 @@
+#ifndef ENHANCED_STATE_H_INCLUDED
+#define ENHANCED_STATE_H_INCLUDED
+
+#include <assert.h>
+
+#include <array>
+
+// Position representation shared by the rules engine (State) and the search
+// algorithms, which tracks the state of each line on the board incrementally.
+//
+// Unlike State, it doesn't track quarto calls or passes: the search only
+// considers moves that don't allow the opponent to win immediately, so a
+// position where the player who must select a piece has no safe piece left is
+// lost, and a position where all pieces have been placed is a tie.
+
+// For each field, the indices of the lines (rows 0-3, columns 4-7, and
+// diagonals 8-9) it lies on, terminated by -1.
+extern const signed char lines_per_field[16][4];
+
+struct LineInfo {
+    unsigned char common_values = 0xff;
+    unsigned char spaces_left = 4;
+};
+
+struct EnhancedState {
+    // Number of next piece to place, or -1 if we need to select the next piece.
+    signed char next_piece = -1;
+
+    // Bitmask of available pieces (excluding next_piece).
+    unsigned short pieces = 0xffff;
+
+    // For each field, the number of a piece, or -1 if the field is empty.
+    std::array<signed char, 16> fields = {
+        -1, -1, -1, -1,
+        -1, -1, -1, -1,
+        -1, -1, -1, -1,
+        -1, -1, -1, -1};
+
+    // State of each line on the board.
+    std::array<LineInfo, 10> lines;
+};
+
+// Pieces have four attributes, each of which has two possible values. This
+// returns an 8-bit bitmask with exactly 4 bits set, corresponding with the
+// attribute values of the piece.
+constexpr unsigned AttributeValues(int piece) {
+    return (piece << 4) | (piece ^ 0xf);
+}
+
+// Lists the pieces that can be selected without allowing the opponent to win
+// immediately, or the fields where the next piece can be placed. Returns the
+// number of moves stored in `moves`.
+inline int ListNonlosingMoves(const EnhancedState &est, std::array<int, 16> &moves) {
+    unsigned char winning_values = 0;
+    for (const LineInfo &line : est.lines) {
+        if (line.spaces_left == 1) {
+            winning_values |= line.common_values;
+        }
+    }
+    int n = 0;
+    if (est.next_piece < 0) {
+        // We must select the piece to place.
+        // Consider only moves that don't allow the opponent to win immediately.
+        for (int i = 0; i < 16; ++i) {
+            if ((est.pieces & (1 << i)) == 0) continue;
+            if ((winning_values & AttributeValues(i)) != 0) continue;
+            moves[n++] = i;
+        }
+    } else {
+        // We must place a piece. Any empty field works.
+        for (int i = 0; i < 16; ++i) {
+            if (est.fields[i] < 0) {
+                moves[n++] = i;
+            }
+        }
+    }
+    return n;
+}
+
+inline void Select(EnhancedState &est, int piece) {
+    assert(piece >= 0 && piece < 16);
+    assert(est.next_piece == -1);
+    assert(est.pieces & (1 << piece));
+    est.next_piece = piece;
+    est.pieces -= (1 << piece);
+}
+
+inline void Place(EnhancedState &est, int field) {
+    assert(field >= 0 && field < 16);
+    assert(est.next_piece >= 0);
+    assert(est.fields[field] < 0);
+    int piece = est.next_piece;
+    est.next_piece = -1;
+    est.fields[field] = piece;
+    unsigned values = AttributeValues(piece);
+    for (const signed char *p = lines_per_field[field]; *p >= 0; ++p) {
+        LineInfo &line = est.lines[*p];
+        line.spaces_left -= 1;
+        line.common_values &= values;
+    }
+}
+
+// Returns whether placing the next piece on the given field completes a line
+// of four pieces with a common attribute.
+inline bool IsWinningPlacement(const EnhancedState &est, int field) {
+    assert(est.next_piece >= 0);
+    assert(est.fields[field] < 0);
+    unsigned values = AttributeValues(est.next_piece);
+    for (const signed char *p = lines_per_field[field]; *p >= 0; ++p) {
+        const LineInfo &line = est.lines[*p];
+        if (line.spaces_left == 1 && (line.common_values & values) != 0) return true;
+    }
+    return false;
+}
+
+#endif /* ndef ENHANCED_STATE_H_INCLUDED */
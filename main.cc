@@ -1,16 +1,25 @@
 #include "quarto.h"
 #include "ai_mcts.h"
+#include "ai_pns.h"
+#include "ai_distributed.h"
+#include "ai_parallel.h"
+#include "notation.h"
+#include "position_db.h"
+#include "result_cache.h"
 
 #include <assert.h>
 #include <ctype.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <array>
 #include <algorithm>
+#include <chrono>
 #include <iostream>
 #include <iomanip>
 #include <memory>
 #include <optional>
+#include <sstream>
 #include <string>
 #include <vector>
 
@@ -22,19 +31,6 @@
 
 namespace {
 
-const char *palette = "ab+-01xy";
-
-const std::array<std::string, 16> piece_ids = []{
-    std::array<std::string, 16> ids;
-    for (int i = 0; i < 16; ++i) {
-        ids[i].resize(4);
-        for (int j = 0; j < 4; ++j) {
-            ids[i][j] = palette[2*j + ((i >> (3 - j)) & 1)];
-        }
-    }
-    return ids;
-}();
-
 std::string Rtrim(const std::string &s, char ch) {
     size_t i = s.size();
     while (i > 0 && s[i - 1] == ch) --i;
@@ -110,51 +106,6 @@ void DrawState(std::ostream &os, const State &state) {
     for (const auto &line : grid) os << Rtrim(line, ' ') << '\n';
 }
 
-std::optional<Move> ParseMove(const std::string &line) {
-    std::string lower = ToLower(line);
-    if (lower.size() == 2 &&
-            (lower[0] >= 'a' && lower[0] <= 'd') &&
-            (lower[1] >= '1' && lower[1] <= '4')) {
-        return Move::Place(4*('4' - lower[1]) + (lower[0] - 'a'));
-    }
-    if (lower == "p" || lower == "pass") {
-        return Move::Pass();
-    }
-    if (lower == "q" || lower == "quarto") {
-        return Move::Quarto();
-    }
-    for (int i = 0; i < piece_ids.size(); ++i) {
-        if (lower == ToLower(piece_ids[i])) {
-            return Move::Select(i);
-        }
-    }
-    return std::nullopt;
-}
-
-std::ostream &operator<<(std::ostream &os, Move move) {
-    switch (move.GetType()) {
-    case Move::Type::SELECT:
-        return os << piece_ids.at(move.SelectedPiece());
-    case Move::Type::PLACE:
-        {
-            int field = move.PlacedField();
-            if (field >= 0) {
-                char a = 'A' + (field % 4);
-                char b = '4' - (field / 4);
-                return os << a << b;
-            }
-            assert(false);
-            return os;
-        }
-    case Move::Type::QUARTO:
-        return os << "quarto";
-    case Move::Type::PASS:
-        return os << "pass";
-    }
-    assert(false);
-    return os;
-}
-
 USED_IN_ASSERT
 bool AllMovesValid(const State &state, const std::vector<Move> &moves) {
     for (Move move : moves) {
@@ -163,34 +114,6 @@ bool AllMovesValid(const State &state, const std::vector<Move> &moves) {
     return true;
 }
 
-static const char base34digits[] = "0123456789abcdefghijklmnopqrstuvwx";
-
-std::optional<Move> DecodeMove(char ch) {
-    const char *p = strchr(base34digits, ch);
-    if (!p) return std::nullopt;
-    int i = p - base34digits;
-    assert(i >= 0 && i < 34);
-    if (i < 16) return Move::Select(i);
-    if (i < 32) return Move::Place(i - 16);
-    if (i == 32) return Move::Quarto();
-    if (i == 33) return Move::Pass();
-    return std::nullopt;  // unreachable
-}
-
-char EncodeMove(Move move) {
-    switch (move.GetType()) {
-    case Move::Type::SELECT:
-        return base34digits[move.SelectedPiece()];
-    case Move::Type::PLACE:
-        return base34digits[move.PlacedField() + 16];
-    case Move::Type::QUARTO:
-        return base34digits[32];
-    case Move::Type::PASS:
-        return base34digits[33];
-    }
-    return '?';  // unreachable
-}
-
 void PrintHistory(std::ostream& os, const std::vector<Move> moves) {
     os << " 0. ..";
     for (size_t i = 0; i < moves.size(); ++i) {
@@ -206,18 +129,156 @@ void PrintHistory(std::ostream& os, const std::vector<Move> moves) {
     os << '\n';
 }
 
+void PrintUsage(std::ostream &os) {
+    os << "Usage:\n"
+        "  quarto [<options>] [<state>]\n"
+        "  quarto --worker=<address>\n"
+        "\n"
+        "Options:\n"
+        "  --workers=<address>[,<address>...]  distribute AI search over remote workers\n"
+        "  --local-workers=<count>             distribute AI search over local processes\n"
+        "                                      (both only with --ai=mcts)\n"
+        "  --ai=mcts                           Monte Carlo tree search (default)\n"
+        "  --ai=pns                            play proven moves found by proof-number\n"
+        "                                      search, falling back to Monte Carlo\n"
+        "  --ai=hybrid                         Monte Carlo tree search that proves\n"
+        "                                      promising nodes with proof-number search\n"
+        "  --threads=<count>                   search with this many threads (default: 1;\n"
+        "                                      not with --ai=pns or workers)\n"
+        "  --affinity=node|cpu|none            pin each search thread to the CPUs of one\n"
+        "                                      NUMA node (default), to one CPU, or not at all\n"
+        "  --topology=<cpus>[/<cpus>...]       CPUs of each NUMA node, e.g. 0-7,16-23/8-15\n"
+        "                                      (default: read from /sys)\n"
+        "  --position-db=<file>                order the AI's moves by the statistics in a\n"
+        "                                      position database (see quarto-db)\n"
+        "  --mcts-config=<name>=<value>,...    set search parameters, e.g. as found by\n"
+        "                                      quarto-tune\n"
+        "  --cache-size=<MiB>                  reuse the AI's results for positions it has\n"
+        "                                      searched before (default: 0, off; 64 if a\n"
+        "                                      cache file is given)\n"
+        "  --cache-file=<file>                 load the result cache from a file, and save\n"
+        "                                      it there every minute and at exit\n"
+        "\n"
+        "Addresses are written as unix:<path> or tcp:<host>:<port>.\n";
+}
+
+// Returns the search that the AI's last move was chosen from, if it can be
+// cached.
+const AiMcts *LastSearch(const Ai &ai) {
+    if (const AiMcts *mcts = dynamic_cast<const AiMcts*>(&ai)) return mcts;
+    if (const AiParallel *parallel = dynamic_cast<const AiParallel*>(&ai)) return parallel->LastSearch();
+    if (const AiDistributed *distributed = dynamic_cast<const AiDistributed*>(&ai)) {
+        return &distributed->LastSearch();
+    }
+    return nullptr;
+}
+
+bool ParseOption(const std::string &arg, const std::string &name, std::string &value) {
+    std::string prefix = "--" + name + "=";
+    if (arg.compare(0, prefix.size(), prefix) != 0) return false;
+    value = arg.substr(prefix.size());
+    return true;
+}
+
 }  // namespace
 
 int main(int argc, char* argv[]) {
-    if (argc > 2) {
-        std::cerr << "Unexpected arguments! Usage: quarto [<state>]" << std::endl;
+    std::optional<std::string> initial_state;
+    std::string worker_address;
+    std::string remote_workers;
+    int local_workers = 0;
+    std::string ai_type = "mcts";
+    std::string position_db_path;
+    AiMctsConfig mcts_config;
+    size_t cache_mib = 0;
+    std::string cache_path;
+    ParallelConfig parallel_config;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        std::string value;
+        if (ParseOption(arg, "worker", value)) {
+            worker_address = value;
+        } else if (ParseOption(arg, "workers", value)) {
+            remote_workers = value;
+        } else if (ParseOption(arg, "local-workers", value)) {
+            local_workers = atoi(value.c_str());
+        } else if (ParseOption(arg, "ai", value) &&
+                (value == "mcts" || value == "pns" || value == "hybrid")) {
+            ai_type = value;
+        } else if (ParseOption(arg, "threads", value)) {
+            parallel_config.threads = std::max(1, atoi(value.c_str()));
+        } else if (ParseOption(arg, "affinity", value) && ParseAffinity(value)) {
+            parallel_config.affinity = *ParseAffinity(value);
+        } else if (ParseOption(arg, "topology", value)) {
+            std::optional<CpuTopology> topology = ParseTopology(value);
+            if (!topology) {
+                std::cerr << "Invalid topology: " << value << '\n';
+                return 1;
+            }
+            parallel_config.topology = *topology;
+        } else if (ParseOption(arg, "position-db", value)) {
+            position_db_path = value;
+        } else if (ParseOption(arg, "mcts-config", value)) {
+            if (!ParseAiMctsConfig(value, mcts_config)) {
+                std::cerr << "Invalid search parameters: " << value << '\n';
+                return 1;
+            }
+        } else if (ParseOption(arg, "cache-size", value)) {
+            cache_mib = std::max(0, atoi(value.c_str()));
+        } else if (ParseOption(arg, "cache-file", value)) {
+            cache_path = value;
+        } else if (arg == "-h" || arg == "--help") {
+            PrintUsage(std::cout);
+            return 0;
+        } else if (arg.compare(0, 2, "--") != 0 && !initial_state) {
+            initial_state = arg;
+        } else {
+            std::cerr << "Unexpected argument: " << arg << '\n';
+            PrintUsage(std::cerr);
+            return 1;
+        }
+    }
+    if (!worker_address.empty()) {
+        return RunWorker(worker_address);
+    }
+    if ((!remote_workers.empty() || local_workers > 0) && ai_type != "mcts") {
+        // Workers only run plain Monte Carlo searches.
+        std::cerr << "--workers and --local-workers can't be combined with --ai=" << ai_type << '\n';
         return 1;
     }
+    if (parallel_config.threads > 1 && (ai_type == "pns" || !remote_workers.empty() || local_workers > 0)) {
+        std::cerr << "--threads can't be combined with --ai=pns, --workers or --local-workers\n";
+        return 1;
+    }
+
+    std::unique_ptr<PositionDatabase> position_db;
+    if (!position_db_path.empty()) {
+        position_db = std::make_unique<PositionDatabase>(position_db_path);
+        if (!position_db->Ok()) return 1;
+    }
+
+    if (!cache_path.empty() && cache_mib == 0) cache_mib = 64;
+    if (cache_mib > 0 && ai_type == "pns") {
+        std::cerr << "Warning: the result cache isn't used with --ai=pns.\n";
+        cache_mib = 0;
+    }
+    std::unique_ptr<ResultCache> cache;
+    if (cache_mib > 0) {
+        // Everything the AI's results depend on, besides position and budget.
+        std::ostringstream configuration;
+        configuration << "ai=" << ai_type << ";threads=" << parallel_config.threads
+                << ";workers=" << remote_workers << ";local_workers=" << local_workers
+                << ";position_db=" << position_db_path << ";" << FormatAiMctsConfig(mcts_config);
+        cache = std::make_unique<ResultCache>(cache_mib << 20, configuration.str());
+        if (!cache_path.empty() && !cache->Load(cache_path)) return 1;
+    }
+    CacheSaver cache_saver(cache.get(), cache_path);
+
     std::unique_ptr<Ai> ai;
     State state = State::Initial();
     std::vector<Move> history;
-    if (argc == 2) {
-        for (const char *p = argv[1]; *p; ++p) {
+    if (initial_state) {
+        for (const char *p = initial_state->c_str(); *p; ++p) {
             std::optional<Move> move = DecodeMove(*p);
             if (!move) {
                 std::cerr << "Unrecognized move '" << *p << "'." << std::endl;
@@ -230,6 +291,38 @@ int main(int argc, char* argv[]) {
             history.push_back(*move);
         }
     }
+    std::vector<int> worker_fds;
+    if (!remote_workers.empty()) {
+        worker_fds = ConnectToWorkers(remote_workers);
+        if (worker_fds.empty()) return 1;
+    }
+    if (local_workers > 0) {
+        std::vector<int> fds = SpawnLocalWorkers(local_workers);
+        worker_fds.insert(worker_fds.end(), fds.begin(), fds.end());
+    }
+    if (parallel_config.threads > 1) {
+        std::cout << "Search threads: " << parallel_config.threads << ", NUMA nodes: "
+                << FormatTopology(parallel_config.topology.value_or(SystemTopology())) << std::endl;
+    }
+    auto create_ai = [&worker_fds, &ai_type, &position_db, &mcts_config, &parallel_config](
+            const State &state) -> std::unique_ptr<Ai> {
+        AiMctsConfig config = mcts_config;
+        config.position_db = position_db.get();
+        if (ai_type == "pns") {
+            AiPns::Options options;
+            options.fallback_config = config;
+            return std::make_unique<AiPns>(state, options);
+        }
+        if (ai_type == "hybrid") config.pns_visits = 1000;
+        if (worker_fds.empty()) {
+            if (parallel_config.threads > 1) return std::make_unique<AiParallel>(state, config, parallel_config);
+            return std::make_unique<AiMcts>(state, config);
+        }
+        // Workers are handed over to the first AI created.
+        auto ai = std::make_unique<AiDistributed>(state, std::move(worker_fds), config);
+        worker_fds.clear();
+        return ai;
+    };
     while (!state.Over()) {
         assert(AllMovesValid(state, state.ListValidMoves()));  // sanity check
 
@@ -264,9 +357,23 @@ int main(int argc, char* argv[]) {
                 continue;
             }
             if (lower_line == "a" || lower_line == "ai") {
-                if (!ai) ai = std::make_unique<AiMcts>(state);
+                const SearchBudget budget{mcts_config.iterations_per_move, std::chrono::milliseconds(0)};
+                if (std::optional<CachedResult> result = cache ? cache->Lookup(state, budget) : std::nullopt) {
+                    move = result->best_move;
+                    std::cout << "AI chose move: " << *move << " (cached, expected value "
+                            << std::fixed << std::setprecision(3) << result->expected_value
+                            << (result->Solved() ? ", solved" : "") << ")" << std::endl;
+                    assert(state.IsValid(*move));
+                    continue;
+                }
+                if (!ai) ai = create_ai(state);
                 move = ai->CalculateMove();
                 std::cout << "AI chose move: " << *move << std::endl;
+                const AiMcts *search = cache ? LastSearch(*ai) : nullptr;
+                if (std::optional<CachedResult> result = search ? ResultOfSearch(*search, *move) : std::nullopt) {
+                    cache->Store(state, budget, *result);
+                    cache_saver.SaveIfDue();
+                }
                 assert(state.IsValid(*move));
                 continue;
             }
@@ -0,0 +1,234 @@
+#include "net.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <netdb.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <iostream>
+
+namespace {
+
+struct ParsedAddress {
+    bool unix_domain;
+    std::string path;  // for Unix-domain sockets
+    std::string host;  // for TCP sockets
+    std::string port;  // for TCP sockets
+};
+
+bool ParseAddress(const std::string &address, ParsedAddress &result) {
+    if (address.compare(0, 5, "unix:") == 0) {
+        result.unix_domain = true;
+        result.path = address.substr(5);
+        if (result.path.empty() || result.path.size() >= sizeof(sockaddr_un::sun_path)) {
+            std::cerr << "Invalid socket path: " << address << std::endl;
+            return false;
+        }
+        return true;
+    }
+    if (address.compare(0, 4, "tcp:") == 0) {
+        result.unix_domain = false;
+        std::string rest = address.substr(4);
+        size_t colon = rest.rfind(':');
+        if (colon == std::string::npos) {
+            result.port = rest;
+        } else {
+            result.host = rest.substr(0, colon);
+            result.port = rest.substr(colon + 1);
+        }
+        if (result.port.empty()) {
+            std::cerr << "Missing port number: " << address << std::endl;
+            return false;
+        }
+        return true;
+    }
+    std::cerr << "Unrecognized address (expected unix:<path> or tcp:<host>:<port>): "
+            << address << std::endl;
+    return false;
+}
+
+sockaddr_un UnixSocketAddress(const std::string &path) {
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    return addr;
+}
+
+// Resolves a TCP address and calls `use` for each candidate until it returns a
+// valid socket descriptor.
+template<class F>
+int WithTcpAddress(const ParsedAddress &parsed, bool passive, F use) {
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (passive) hints.ai_flags = AI_PASSIVE;
+    addrinfo *info = nullptr;
+    int err = getaddrinfo(parsed.host.empty() ? nullptr : parsed.host.c_str(),
+            parsed.port.c_str(), &hints, &info);
+    if (err != 0) {
+        std::cerr << "Could not resolve " << parsed.host << ':' << parsed.port << ": "
+                << gai_strerror(err) << std::endl;
+        return -1;
+    }
+    int fd = -1;
+    for (addrinfo *ai = info; ai != nullptr && fd < 0; ai = ai->ai_next) {
+        fd = use(ai);
+    }
+    freeaddrinfo(info);
+    return fd;
+}
+
+// Waits until the socket has input (or has been closed). Returns false if the
+// deadline passes first, or on error.
+bool WaitForInput(int fd, std::chrono::steady_clock::time_point deadline) {
+    for (;;) {
+        // Input that is already there counts even after the deadline.
+        auto remaining = std::chrono::ceil<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now()).count();
+        pollfd pfd = {fd, POLLIN, 0};
+        int n = poll(&pfd, 1, std::clamp<decltype(remaining)>(remaining, 0, INT_MAX));
+        if (n > 0) return true;
+        if (n == 0 || errno != EINTR) return false;
+    }
+}
+
+}  // namespace
+
+int ListenOn(const std::string &address) {
+    ParsedAddress parsed;
+    if (!ParseAddress(address, parsed)) return -1;
+    int fd = -1;
+    if (parsed.unix_domain) {
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) {
+            perror("socket");
+            return -1;
+        }
+        sockaddr_un addr = UnixSocketAddress(parsed.path);
+        unlink(parsed.path.c_str());  // remove stale socket, if any
+        if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+            perror("bind");
+            close(fd);
+            return -1;
+        }
+    } else {
+        fd = WithTcpAddress(parsed, true, [](addrinfo *ai) {
+            int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if (fd < 0) return -1;
+            int one = 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            if (bind(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+                close(fd);
+                return -1;
+            }
+            return fd;
+        });
+        if (fd < 0) {
+            std::cerr << "Could not bind to " << address << std::endl;
+            return -1;
+        }
+    }
+    if (listen(fd, 64) != 0) {
+        perror("listen");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int ConnectTo(const std::string &address) {
+    ParsedAddress parsed;
+    if (!ParseAddress(address, parsed)) return -1;
+    if (parsed.unix_domain) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) {
+            perror("socket");
+            return -1;
+        }
+        sockaddr_un addr = UnixSocketAddress(parsed.path);
+        if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+            std::cerr << "Could not connect to " << address << ": " << strerror(errno) << std::endl;
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+    int fd = WithTcpAddress(parsed, false, [](addrinfo *ai) {
+        int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) return -1;
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    });
+    if (fd < 0) {
+        std::cerr << "Could not connect to " << address << std::endl;
+    }
+    return fd;
+}
+
+int AcceptConnection(int listen_fd) {
+    for (;;) {
+        int fd = accept(listen_fd, nullptr, nullptr);
+        if (fd >= 0 || errno != EINTR) return fd;
+    }
+}
+
+bool WriteAll(int fd, const std::string &data) {
+    size_t pos = 0;
+    while (pos < data.size()) {
+        // MSG_NOSIGNAL prevents SIGPIPE if the peer has disconnected.
+        ssize_t n = send(fd, data.data() + pos, data.size() - pos, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        pos += n;
+    }
+    return true;
+}
+
+bool LineReader::Fill() {
+    char buf[4096];
+    for (;;) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n > 0) {
+            buffer.append(buf, n);
+            return true;
+        }
+        if (n == 0) return false;
+        if (errno == EINTR) continue;
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+}
+
+bool LineReader::NextBufferedLine(std::string &line) {
+    size_t newline = buffer.find('\n');
+    if (newline == std::string::npos) return false;
+    line.assign(buffer, 0, newline);
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    buffer.erase(0, newline + 1);
+    return true;
+}
+
+bool LineReader::ReadLine(std::string &line) {
+    while (!NextBufferedLine(line)) {
+        if (!Fill()) return false;
+    }
+    return true;
+}
+
+bool LineReader::ReadLine(std::string &line, std::chrono::steady_clock::time_point deadline) {
+    while (!NextBufferedLine(line)) {
+        if (!WaitForInput(fd, deadline) || !Fill()) return false;
+    }
+    return true;
+}
@@ -0,0 +1,53 @@
+#ifndef NET_H_INCLUDED
+#define NET_H_INCLUDED
+
+#include <chrono>
+#include <string>
+
+// Minimal helpers for line-based protocols over stream sockets.
+//
+// Addresses are written as "unix:<path>" for Unix-domain sockets, or as
+// "tcp:<host>:<port>" for TCP sockets (host may be omitted when listening, to
+// listen on all interfaces).
+//
+// All functions return -1 or false on failure, after printing a message to
+// std::cerr.
+
+// Creates a socket listening on the given address and returns its descriptor.
+int ListenOn(const std::string &address);
+
+// Connects to the given address and returns the socket descriptor.
+int ConnectTo(const std::string &address);
+
+// Accepts a connection on a listening socket.
+int AcceptConnection(int listen_fd);
+
+// Writes all of `data` to the socket.
+bool WriteAll(int fd, const std::string &data);
+
+// Buffers input from a socket so it can be read line by line.
+class LineReader {
+public:
+    explicit LineReader(int fd) : fd(fd) {}
+
+    // Reads the next line (without the trailing newline) into `line`.
+    // Returns false at end of input or on error.
+    bool ReadLine(std::string &line);
+
+    // Like ReadLine(), but also returns false if no complete line has arrived
+    // by the deadline.
+    bool ReadLine(std::string &line, std::chrono::steady_clock::time_point deadline);
+
+    // Reads whatever input is available without blocking, if the socket is in
+    // non-blocking mode. Returns false at end of input or on error.
+    bool Fill();
+
+    // Extracts the next complete line from the buffer, if there is one.
+    bool NextBufferedLine(std::string &line);
+
+private:
+    int fd;
+    std::string buffer;
+};
+
+#endif /* ndef NET_H_INCLUDED */
@@ -0,0 +1,147 @@
+#include "notation.h"
+
+#include <assert.h>
+#include <ctype.h>
+#include <string.h>
+
+#include <algorithm>
+#include <iostream>
+
+namespace {
+
+const char *palette = "ab+-01xy";
+
+const char base34digits[] = "0123456789abcdefghijklmnopqrstuvwx";
+
+std::string ToLower(std::string s) {
+    std::transform(s.begin(), s.end(), s.begin(), ::tolower);
+    return s;
+}
+
+}  // namespace
+
+const std::array<std::string, 16> piece_ids = []{
+    std::array<std::string, 16> ids;
+    for (int i = 0; i < 16; ++i) {
+        ids[i].resize(4);
+        for (int j = 0; j < 4; ++j) {
+            ids[i][j] = palette[2*j + ((i >> (3 - j)) & 1)];
+        }
+    }
+    return ids;
+}();
+
+std::optional<Move> ParseMove(const std::string &line) {
+    std::string lower = ToLower(line);
+    if (lower.size() == 2 &&
+            (lower[0] >= 'a' && lower[0] <= 'd') &&
+            (lower[1] >= '1' && lower[1] <= '4')) {
+        return Move::Place(4*('4' - lower[1]) + (lower[0] - 'a'));
+    }
+    if (lower == "p" || lower == "pass") {
+        return Move::Pass();
+    }
+    if (lower == "q" || lower == "quarto") {
+        return Move::Quarto();
+    }
+    for (int i = 0; i < piece_ids.size(); ++i) {
+        if (lower == ToLower(piece_ids[i])) {
+            return Move::Select(i);
+        }
+    }
+    return std::nullopt;
+}
+
+std::ostream &operator<<(std::ostream &os, Move move) {
+    switch (move.GetType()) {
+    case Move::Type::SELECT:
+        return os << piece_ids.at(move.SelectedPiece());
+    case Move::Type::PLACE:
+        {
+            int field = move.PlacedField();
+            if (field >= 0) {
+                char a = 'A' + (field % 4);
+                char b = '4' - (field / 4);
+                return os << a << b;
+            }
+            assert(false);
+            return os;
+        }
+    case Move::Type::QUARTO:
+        return os << "quarto";
+    case Move::Type::PASS:
+        return os << "pass";
+    }
+    assert(false);
+    return os;
+}
+
+std::optional<Move> DecodeMove(char ch) {
+    if (ch == '\0') return std::nullopt;
+    const char *p = strchr(base34digits, ch);
+    if (!p) return std::nullopt;
+    int i = p - base34digits;
+    assert(i >= 0 && i < 34);
+    if (i < 16) return Move::Select(i);
+    if (i < 32) return Move::Place(i - 16);
+    if (i == 32) return Move::Quarto();
+    if (i == 33) return Move::Pass();
+    return std::nullopt;  // unreachable
+}
+
+char EncodeMove(Move move) {
+    switch (move.GetType()) {
+    case Move::Type::SELECT:
+        return base34digits[move.SelectedPiece()];
+    case Move::Type::PLACE:
+        return base34digits[move.PlacedField() + 16];
+    case Move::Type::QUARTO:
+        return base34digits[32];
+    case Move::Type::PASS:
+        return base34digits[33];
+    }
+    return '?';  // unreachable
+}
+
+std::optional<State> DecodeState(const std::string &compact, std::vector<Move> *history) {
+    State state = State::Initial();
+    for (char ch : compact) {
+        std::optional<Move> move = DecodeMove(ch);
+        if (!move || !state.Execute(*move)) return std::nullopt;
+        if (history) history->push_back(*move);
+    }
+    return state;
+}
+
+std::string EncodeState(const State &state) {
+    std::string result;
+    auto add = [&result](Move move) { result += EncodeMove(move); };
+    int placed = 0;
+    bool last_piece_placed = false;
+    for (int field = 0; field < 16; ++field) {
+        if (!state.Empty(field)) {
+            ++placed;
+            if (state.PieceAt(field) == state.LastPiece()) last_piece_placed = true;
+            if (field != state.LastField()) {
+                add(Move::Select(state.PieceAt(field)));
+                add(Move::Place(field));
+            }
+        }
+    }
+    // The last field must be filled last, so that a quarto formed through it
+    // can still be called.
+    if (state.LastField() >= 0) {
+        add(Move::Select(state.PieceAt(state.LastField())));
+        add(Move::Place(state.LastField()));
+    }
+    if (state.LastPiece() >= 0 && !last_piece_placed) {
+        add(Move::Select(state.LastPiece()));
+    }
+    if (placed == 16) {
+        // The first pass clears the last piece; the second clears the last field.
+        if (state.LastPiece() < 0) add(Move::Pass());
+        if (state.LastField() < 0) add(Move::Pass());
+    }
+    if (state.Winner() >= 0) add(Move::Quarto());
+    return result;
+}
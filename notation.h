@@ -0,0 +1,36 @@
+#ifndef NOTATION_H_INCLUDED
+#define NOTATION_H_INCLUDED
+
+#include "quarto.h"
+
+#include <array>
+#include <iosfwd>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Human-readable piece identifiers (e.g. "a+0x"), indexed by piece number.
+extern const std::array<std::string, 16> piece_ids;
+
+// Parses a move as entered by the user (e.g. "a+0x", "C4", "q", "pass").
+std::optional<Move> ParseMove(const std::string &line);
+
+std::ostream &operator<<(std::ostream &os, Move move);
+
+// Compact notation encodes each move as a single base-34 digit: 0-f select a
+// piece, g-v place on a field, w calls quarto and x passes.
+std::optional<Move> DecodeMove(char ch);
+char EncodeMove(Move move);
+
+// Replays a string of compactly encoded moves from the initial state. Returns
+// std::nullopt if the string contains an unrecognized or invalid move. If
+// `history` is not null, the decoded moves are appended to it.
+std::optional<State> DecodeState(const std::string &compact, std::vector<Move> *history = nullptr);
+
+// Returns a compact move string which, when replayed from the initial state,
+// yields a state equivalent to `state`. This is not necessarily the history
+// that actually led to `state` (which isn't recorded) but it reproduces the
+// board, the available pieces, and the last field and piece.
+std::string EncodeState(const State &state);
+
+#endif /* ndef NOTATION_H_INCLUDED */
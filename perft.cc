@@ -0,0 +1,309 @@
+// Counts the move sequences (and optionally the distinct positions) reachable
+// from a position, up to a given depth.
+//
+// Usage: quarto-perft [<options>] [<state>]
+//
+// This serves both as a benchmark for move generation and as a cross-check
+// between the rules engine (State) and the search's move generator
+// (EnhancedState): with --verify, the non-losing move tree is generated both
+// ways and the counts must match.
+
+#include "quarto.h"
+#include "enhanced_state.h"
+#include "notation.h"
+#include "symmetry.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+namespace {
+
+// Key for a full game state. Positions at the same depth have made the same
+// number of moves, so this only needs to add what EnhancedState lacks: the
+// last field (which determines whether quarto can be called), and whether
+// quarto was called. Keys of EnhancedStates leave these at their defaults.
+struct FullKey {
+    PositionKey position;
+    int8_t last_field = -1;
+    bool over = false;
+
+    bool operator==(const FullKey &k) const {
+        return position == k.position && last_field == k.last_field && over == k.over;
+    }
+};
+
+struct FullKeyHash {
+    size_t operator()(const FullKey &k) const {
+        return k.position.Hash() ^ ((k.last_field + 1) << 1 | k.over) * 0x9e3779b97f4a7c15ULL;
+    }
+};
+
+FullKey StateKey(const State &state) {
+    return FullKey{MakeKey(state.Enhanced()), static_cast<int8_t>(state.LastField()), state.Over()};
+}
+
+FullKey SearchKey(const EnhancedState &est) {
+    return FullKey{MakeKey(est)};
+}
+
+// Per-depth statistics collected by a single thread.
+struct Counts {
+    std::vector<uint64_t> sequences;
+    std::vector<std::unordered_set<FullKey, FullKeyHash>> positions;
+
+    Counts(int depth, bool distinct) : sequences(depth + 1), positions(distinct ? depth + 1 : 0) {}
+
+    void Add(const Counts &c) {
+        for (size_t i = 0; i < sequences.size(); ++i) sequences[i] += c.sequences[i];
+        for (size_t i = 0; i < positions.size(); ++i) {
+            positions[i].insert(c.positions[i].begin(), c.positions[i].end());
+        }
+    }
+};
+
+// All moves allowed by the rules.
+void PerftRules(const State &state, int ply, int depth, Counts &counts) {
+    if (!counts.positions.empty()) counts.positions[ply].insert(StateKey(state));
+    if (ply == depth || state.Over()) return;
+    for (Move move : state.ListValidMoves()) {
+        State child = state;
+        child.ExecuteValid(move);
+        ++counts.sequences[ply + 1];
+        PerftRules(child, ply + 1, depth, counts);
+    }
+}
+
+// Non-losing moves, as generated by the search.
+void PerftSearch(const EnhancedState &est, int ply, int depth, Counts &counts) {
+    if (!counts.positions.empty()) counts.positions[ply].insert(SearchKey(est));
+    if (ply == depth) return;
+    std::array<int, 16> moves;
+    int num_moves = ListNonlosingMoves(est, moves);
+    for (int i = 0; i < num_moves; ++i) {
+        EnhancedState child = est;
+        if (est.next_piece < 0) Select(child, moves[i]); else Place(child, moves[i]);
+        ++counts.sequences[ply + 1];
+        PerftSearch(child, ply + 1, depth, counts);
+    }
+}
+
+// Non-losing moves, derived from the rules engine only: a piece may be
+// selected if no placement of it allows the opponent to call quarto.
+std::vector<Move> ListNonlosingMovesByRules(const State &state) {
+    std::vector<Move> result;
+    for (Move move : state.ListValidMoves()) {
+        if (move.GetType() == Move::Type::PLACE) {
+            result.push_back(move);
+        } else if (move.GetType() == Move::Type::SELECT) {
+            State selected = state;
+            selected.ExecuteValid(move);
+            bool safe = true;
+            for (Move place : selected.ListValidMoves()) {
+                if (place.GetType() != Move::Type::PLACE) continue;
+                State placed = selected;
+                placed.ExecuteValid(place);
+                if (placed.IsQuartoPossible()) {
+                    safe = false;
+                    break;
+                }
+            }
+            if (safe) result.push_back(move);
+        }
+    }
+    return result;
+}
+
+void PerftSearchByRules(const State &state, int ply, int depth, Counts &counts) {
+    if (!counts.positions.empty()) counts.positions[ply].insert(SearchKey(state.Enhanced()));
+    if (ply == depth) return;
+    for (Move move : ListNonlosingMovesByRules(state)) {
+        State child = state;
+        child.ExecuteValid(move);
+        ++counts.sequences[ply + 1];
+        PerftSearchByRules(child, ply + 1, depth, counts);
+    }
+}
+
+// Runs `perft` on the children of the root in parallel, splitting the work at
+// the root. `root_moves` is the number of children; `visit(i, counts)` must
+// count the subtree of the i-th child (at ply 1).
+template<class F>
+Counts RunParallel(int root_moves, int depth, bool distinct, int threads, F visit) {
+    std::atomic<int> next_move{0};
+    std::vector<Counts> thread_counts(threads, Counts(depth, distinct));
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t]{
+            for (int i; (i = next_move++) < root_moves; ) {
+                ++thread_counts[t].sequences[1];
+                visit(i, thread_counts[t]);
+            }
+        });
+    }
+    for (std::thread &worker : workers) worker.join();
+    Counts total(depth, distinct);
+    for (const Counts &c : thread_counts) total.Add(c);
+    return total;
+}
+
+Counts RunRules(const State &state, int depth, bool distinct, int threads) {
+    std::vector<Move> moves = state.Over() ? std::vector<Move>() : state.ListValidMoves();
+    Counts counts = RunParallel(depth > 0 ? moves.size() : 0, depth, distinct, threads,
+            [&](int i, Counts &c) {
+                State child = state;
+                child.ExecuteValid(moves[i]);
+                PerftRules(child, 1, depth, c);
+            });
+    if (distinct) counts.positions[0].insert(StateKey(state));
+    return counts;
+}
+
+Counts RunSearch(const EnhancedState &est, int depth, bool distinct, int threads) {
+    std::array<int, 16> moves;
+    int num_moves = ListNonlosingMoves(est, moves);
+    Counts counts = RunParallel(depth > 0 ? num_moves : 0, depth, distinct, threads,
+            [&](int i, Counts &c) {
+                EnhancedState child = est;
+                if (est.next_piece < 0) Select(child, moves[i]); else Place(child, moves[i]);
+                PerftSearch(child, 1, depth, c);
+            });
+    if (distinct) counts.positions[0].insert(SearchKey(est));
+    return counts;
+}
+
+Counts RunSearchByRules(const State &state, int depth, bool distinct, int threads) {
+    std::vector<Move> moves = ListNonlosingMovesByRules(state);
+    Counts counts = RunParallel(depth > 0 ? moves.size() : 0, depth, distinct, threads,
+            [&](int i, Counts &c) {
+                State child = state;
+                child.ExecuteValid(moves[i]);
+                PerftSearchByRules(child, 1, depth, c);
+            });
+    if (distinct) counts.positions[0].insert(SearchKey(state.Enhanced()));
+    return counts;
+}
+
+void PrintCounts(const std::string &title, const Counts &counts, double seconds) {
+    uint64_t total = 0;
+    std::cout << title << ":\n";
+    for (size_t ply = 1; ply < counts.sequences.size(); ++ply) {
+        std::cout << "  depth " << std::setw(2) << ply << ": " << std::setw(15) << counts.sequences[ply];
+        if (!counts.positions.empty()) {
+            std::cout << " sequences, " << std::setw(12) << counts.positions[ply].size() << " positions";
+        }
+        std::cout << '\n';
+        total += counts.sequences[ply];
+    }
+    std::cout << "  " << total << " moves in " << std::fixed << std::setprecision(3) << seconds
+            << " s (" << uint64_t(total / std::max(seconds, 1e-9)) << " moves/s)" << std::endl;
+}
+
+template<class F>
+Counts Timed(const std::string &title, F f) {
+    auto start = std::chrono::steady_clock::now();
+    Counts counts = f();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    PrintCounts(title, counts, seconds);
+    return counts;
+}
+
+void PrintUsage(std::ostream &os) {
+    os << "Usage: quarto-perft [<options>] [<state>]\n"
+        "\n"
+        "Options:\n"
+        "  --depth=<n>        number of moves to look ahead (default: 4)\n"
+        "  --threads=<count>  number of worker threads (default: all cores)\n"
+        "  --distinct         also count distinct positions (uses more memory)\n"
+        "  --mode=rules       count all moves allowed by the rules (default)\n"
+        "  --mode=search      count non-losing moves generated for the search\n"
+        "  --verify           count non-losing moves using both the rules engine and\n"
+        "                     the search's move generator, and compare the results\n";
+}
+
+bool ParseOption(const std::string &arg, const std::string &name, std::string &value) {
+    std::string prefix = "--" + name + "=";
+    if (arg.compare(0, prefix.size(), prefix) != 0) return false;
+    value = arg.substr(prefix.size());
+    return true;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+    int depth = 4;
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    bool distinct = false;
+    bool verify = false;
+    std::string mode = "rules";
+    std::string compact;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        std::string value;
+        if (ParseOption(arg, "depth", value)) {
+            depth = atoi(value.c_str());
+        } else if (ParseOption(arg, "threads", value)) {
+            threads = std::max(1, atoi(value.c_str()));
+        } else if (ParseOption(arg, "mode", value) && (value == "rules" || value == "search")) {
+            mode = value;
+        } else if (arg == "--distinct") {
+            distinct = true;
+        } else if (arg == "--verify") {
+            verify = true;
+        } else if (arg == "-h" || arg == "--help") {
+            PrintUsage(std::cout);
+            return 0;
+        } else if (arg.compare(0, 2, "--") != 0 && compact.empty()) {
+            compact = arg;
+        } else {
+            std::cerr << "Unexpected argument: " << arg << '\n';
+            PrintUsage(std::cerr);
+            return 1;
+        }
+    }
+    if (depth < 0 || depth > 34) {
+        std::cerr << "Depth must be between 0 and 34." << std::endl;
+        return 1;
+    }
+    std::optional<State> state = DecodeState(compact);
+    if (!state) {
+        std::cerr << "Invalid state: " << compact << std::endl;
+        return 1;
+    }
+    const bool searchable = !state->Over() &&
+            (state->NextAction() == NextAction::SELECT || state->NextAction() == NextAction::PLACE);
+    if ((verify || mode == "search") && !searchable) {
+        std::cerr << "The search only covers positions where a piece must be selected or placed."
+                << std::endl;
+        return 1;
+    }
+
+    if (verify) {
+        Counts by_rules = Timed("Non-losing moves (State)", [&]{
+            return RunSearchByRules(*state, depth, distinct, threads);
+        });
+        Counts by_search = Timed("Non-losing moves (EnhancedState)", [&]{
+            return RunSearch(state->Enhanced(), depth, distinct, threads);
+        });
+        bool ok = by_rules.sequences == by_search.sequences;
+        for (size_t ply = 0; ply < by_rules.positions.size(); ++ply) {
+            ok = ok && by_rules.positions[ply] == by_search.positions[ply];
+        }
+        std::cout << (ok ? "OK: counts match." : "MISMATCH!") << std::endl;
+        return ok ? 0 : 1;
+    }
+    if (mode == "search") {
+        Timed("Non-losing moves", [&]{ return RunSearch(state->Enhanced(), depth, distinct, threads); });
+    } else {
+        Timed("Valid moves", [&]{ return RunRules(*state, depth, distinct, threads); });
+    }
+    return 0;
+}
@@ -0,0 +1,173 @@
+#include "pns.h"
+
+#include <assert.h>
+
+#include <algorithm>
+
+namespace {
+
+using Goal = ProofNumberSearch::Goal;
+
+constexpr uint32_t infinity = 1u << 30;
+
+// The player to move reaches `goal` if and only if the opponent doesn't reach
+// the complementary goal.
+Goal Complement(Goal goal) {
+    return goal == Goal::WIN ? Goal::NON_LOSS : Goal::WIN;
+}
+
+// Whether the next piece can be placed to complete a line. This can't happen
+// below the root, since only safe pieces are selected.
+bool CanWinImmediately(const EnhancedState &est) {
+    if (est.next_piece < 0) return false;
+    for (int field = 0; field < 16; ++field) {
+        if (est.fields[field] < 0 && IsWinningPlacement(est, field)) return true;
+    }
+    return false;
+}
+
+size_t TableSize(int table_bits) {
+    // Entries are looked up in buckets of two.
+    assert(table_bits >= 1 && table_bits < 64);
+    return size_t(1) << table_bits;
+}
+
+}  // namespace
+
+ProofNumberSearch::ProofNumberSearch(int table_bits) : table(TableSize(table_bits)) {}
+
+void ProofNumberSearch::Clear() {
+    std::fill(table.begin(), table.end(), Entry());
+}
+
+const ProofNumberSearch::Entry *ProofNumberSearch::Find(const PositionKey &key, Goal goal) const {
+    size_t index = (key.Hash() ^ static_cast<uint64_t>(goal)) & (table.size() - 1) & ~size_t(1);
+    for (size_t i = index; i < index + 2; ++i) {
+        const Entry &entry = table[i];
+        if (entry.work > 0 && entry.goal == goal && entry.key == key) return &entry;
+    }
+    return nullptr;
+}
+
+void ProofNumberSearch::Store(const PositionKey &key, Goal goal, Numbers numbers, uint64_t work, int best_move) {
+    size_t index = (key.Hash() ^ static_cast<uint64_t>(goal)) & (table.size() - 1) & ~size_t(1);
+    Entry *victim = &table[index];
+    for (size_t i = index; i < index + 2; ++i) {
+        Entry &entry = table[i];
+        if (entry.work > 0 && entry.goal == goal && entry.key == key) {
+            victim = &entry;
+            break;
+        }
+        if (entry.work < victim->work) victim = &entry;
+    }
+    victim->key = key;
+    victim->goal = goal;
+    victim->phi = numbers.phi;
+    victim->delta = numbers.delta;
+    victim->work = std::clamp<uint64_t>(work, 1, UINT32_MAX);
+    victim->best_move = best_move;
+}
+
+// Returns the stored numbers for the position, or initial estimates if it
+// isn't in the table: positions with many moves are harder to disprove.
+ProofNumberSearch::Numbers ProofNumberSearch::Lookup(const EnhancedState &est, Goal goal) const {
+    if (const Entry *entry = Find(MakeKey(est), goal)) return Numbers{entry->phi, entry->delta};
+    if (CanWinImmediately(est)) return Numbers{0, infinity};
+    std::array<int, 16> moves;
+    int num_moves = ListNonlosingMoves(est, moves);
+    if (num_moves == 0) {
+        // A loss if pieces are left, or a tie if the board is full.
+        bool reached = est.pieces == 0 && goal == Goal::NON_LOSS;
+        return reached ? Numbers{0, infinity} : Numbers{infinity, 0};
+    }
+    return Numbers{1, uint32_t(num_moves)};
+}
+
+// Searches until the proof number reaches thresholds.phi or the disproof
+// number reaches thresholds.delta (or the node limit is reached), and
+// returns the new numbers.
+ProofNumberSearch::Numbers ProofNumberSearch::Expand(
+        const EnhancedState &est, Goal goal, Numbers thresholds) {
+    const int64_t start_nodes = nodes++;
+    Numbers numbers = Lookup(est, goal);
+    if (numbers.phi == 0 || numbers.delta == 0) return numbers;
+
+    std::array<int, 16> moves;
+    const int num_moves = ListNonlosingMoves(est, moves);
+
+    // After selecting a piece, the opponent is to move, so the children's
+    // numbers are for the complementary goal and swap roles.
+    const bool flipped = est.next_piece < 0;
+    const Goal child_goal = flipped ? Complement(goal) : goal;
+    std::array<EnhancedState, 16> children;
+    std::array<Numbers, 16> child_numbers;
+    for (int i = 0; i < num_moves; ++i) {
+        children[i] = est;
+        if (flipped) Select(children[i], moves[i]); else Place(children[i], moves[i]);
+        child_numbers[i] = Lookup(children[i], child_goal);
+    }
+
+    int best = -1;
+    for (;;) {
+        // The player to move needs just one child that reaches the goal, so
+        // the proof number is the minimum and the disproof number the sum.
+        uint32_t phi = infinity, second_phi = infinity;
+        uint64_t delta = 0;
+        best = -1;
+        for (int i = 0; i < num_moves; ++i) {
+            uint32_t p = flipped ? child_numbers[i].delta : child_numbers[i].phi;
+            uint32_t d = flipped ? child_numbers[i].phi : child_numbers[i].delta;
+            if (p < phi) {
+                second_phi = phi;
+                phi = p;
+                best = i;
+            } else if (p < second_phi) {
+                second_phi = p;
+            }
+            delta += d;
+        }
+        numbers.phi = phi;
+        numbers.delta = phi == 0 ? infinity : std::min<uint64_t>(delta, infinity - 1);
+        if (delta == 0) numbers.phi = infinity;
+        if (numbers.phi >= thresholds.phi || numbers.delta >= thresholds.delta ||
+                nodes >= node_limit) {
+            break;
+        }
+        const Numbers &c = child_numbers[best];
+        uint32_t p = std::min<uint64_t>(thresholds.phi, uint64_t(second_phi) + 1);
+        uint32_t d = std::min<uint64_t>(
+                uint64_t(thresholds.delta) - numbers.delta + (flipped ? c.phi : c.delta), infinity);
+        child_numbers[best] = Expand(children[best], child_goal, flipped ? Numbers{d, p} : Numbers{p, d});
+    }
+    Store(MakeKey(est), goal, numbers, nodes - start_nodes,
+            numbers.phi == 0 ? moves[best] : -1);
+    return numbers;
+}
+
+ProofNumberSearch::Answer ProofNumberSearch::Prove(const EnhancedState &est, Goal goal, int64_t max_nodes) {
+    node_limit = nodes + max_nodes;
+    Numbers numbers = Expand(est, goal, Numbers{infinity, infinity});
+    return numbers.phi == 0 ? Answer::PROVEN : numbers.delta == 0 ? Answer::DISPROVEN : Answer::UNKNOWN;
+}
+
+std::optional<int> ProofNumberSearch::Solve(const EnhancedState &est, int64_t max_nodes) {
+    const int64_t limit = nodes + max_nodes;
+    Answer win = Prove(est, Goal::WIN, max_nodes/2);
+    if (win == Answer::PROVEN) return +1;
+    Answer non_loss = Prove(est, Goal::NON_LOSS, std::max<int64_t>(limit - nodes, 1));
+    if (non_loss == Answer::DISPROVEN) return -1;
+    if (non_loss == Answer::PROVEN && win == Answer::DISPROVEN) return 0;
+    return std::nullopt;
+}
+
+int ProofNumberSearch::ProvingMove(const EnhancedState &est, Goal goal) const {
+    const Entry *entry = Find(MakeKey(est), goal);
+    if (entry && entry->phi == 0) return entry->best_move;
+    if (est.next_piece >= 0) {
+        // Immediate wins aren't stored.
+        for (int field = 0; field < 16; ++field) {
+            if (est.fields[field] < 0 && IsWinningPlacement(est, field)) return field;
+        }
+    }
+    return -1;
+}
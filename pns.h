@@ -0,0 +1,70 @@
+#ifndef PNS_H_INCLUDED
+#define PNS_H_INCLUDED
+
+#include "enhanced_state.h"
+#include "symmetry.h"
+
+#include <stdint.h>
+
+#include <optional>
+#include <vector>
+
+// Depth-first proof-number search (df-pn) over EnhancedState.
+//
+// Each search proves or disproves a goal for the player to move: winning, or
+// not losing. Unlike the alpha-beta solver, it concentrates on the moves that
+// look easiest to prove or refute, so it can find narrow forced lines quickly
+// even when the whole tree is too large to search.
+//
+// Proof and disproof numbers are kept in a table of fixed size (2^table_bits
+// entries, with table_bits >= 1), where entries that took the least work to compute are replaced
+// first. Entries are stored per goal, from the perspective of the player to
+// move, so they stay valid between searches from different roots.
+class ProofNumberSearch {
+public:
+    enum class Goal : unsigned char { WIN = 0, NON_LOSS = 1 };
+    enum class Answer { PROVEN, DISPROVEN, UNKNOWN };
+
+    explicit ProofNumberSearch(int table_bits = 20);
+
+    // Tries to prove that the player to move reaches the goal, expanding at
+    // most `max_nodes` nodes.
+    Answer Prove(const EnhancedState &est, Goal goal, int64_t max_nodes);
+
+    // Determines the value of the position for the player to move (-1, 0 or
+    // +1), if possible within `max_nodes` nodes in total.
+    std::optional<int> Solve(const EnhancedState &est, int64_t max_nodes);
+
+    // Returns a move (piece or field) that reaches the goal, if the position
+    // was proven and the proof is still in the table, or -1 otherwise.
+    int ProvingMove(const EnhancedState &est, Goal goal) const;
+
+    // Number of nodes expanded so far.
+    int64_t Nodes() const { return nodes; }
+
+    void Clear();
+
+private:
+    struct Entry {
+        PositionKey key;
+        uint32_t phi = 0, delta = 0;
+        uint32_t work = 0;  // 0 if unused
+        Goal goal = Goal::WIN;
+        signed char best_move = -1;
+    };
+
+    struct Numbers {
+        uint32_t phi, delta;
+    };
+
+    const Entry *Find(const PositionKey &key, Goal goal) const;
+    void Store(const PositionKey &key, Goal goal, Numbers numbers, uint64_t work, int best_move);
+    Numbers Lookup(const EnhancedState &est, Goal goal) const;
+    Numbers Expand(const EnhancedState &est, Goal goal, Numbers thresholds);
+
+    std::vector<Entry> table;
+    int64_t nodes = 0;
+    int64_t node_limit = 0;
+};
+
+#endif /* ndef PNS_H_INCLUDED */
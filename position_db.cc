@@ -0,0 +1,70 @@
+#include "position_db.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <iostream>
+
+const PositionDbHeader position_db_header = {
+    {'Q', 'R', 'T', 'O', 'P', 'D', 'B', '1'}, sizeof(PositionStatsRecord), 0};
+
+PositionDatabase::PositionDatabase(const std::string &path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        perror(path.c_str());
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(PositionDbHeader)) {
+        std::cerr << path << ": not a position database" << std::endl;
+        close(fd);
+        return;
+    }
+    length = st.st_size;
+    void *p = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        return;
+    }
+    const PositionDbHeader *header = static_cast<const PositionDbHeader*>(p);
+    if (memcmp(header->magic, position_db_header.magic, sizeof(header->magic)) != 0 ||
+            header->record_size != sizeof(PositionStatsRecord) ||
+            (length - sizeof(PositionDbHeader)) % sizeof(PositionStatsRecord) != 0) {
+        std::cerr << path << ": unsupported position database format" << std::endl;
+        munmap(p, length);
+        return;
+    }
+    data = p;
+    records = reinterpret_cast<const PositionStatsRecord*>(static_cast<const char*>(p) + sizeof(PositionDbHeader));
+    num_records = (length - sizeof(PositionDbHeader)) / sizeof(PositionStatsRecord);
+    // Lookups touch few pages, in no particular order.
+    madvise(p, length, MADV_RANDOM);
+}
+
+PositionDatabase::~PositionDatabase() {
+    if (data) munmap(data, length);
+}
+
+std::optional<PositionStats> PositionDatabase::Lookup(const EnhancedState &est) const {
+    Symmetry symmetry;
+    const PositionKey key = CanonicalKey(est, &symmetry);
+    const PositionStatsRecord *end = records + num_records;
+    const PositionStatsRecord *it = std::lower_bound(records, end, key,
+            [](const PositionStatsRecord &record, const PositionKey &key) { return record.Key() < key; });
+    if (it == end || it->Key() != key) return std::nullopt;
+    PositionStats stats;
+    stats.games = it->games;
+    stats.wins = it->wins;
+    stats.draws = it->draws;
+    // Equivalent moves may be counted separately, if the position is
+    // symmetric in itself.
+    for (int move = 0; move < 16; ++move) {
+        stats.moves[move] = it->moves[est.next_piece < 0 ? symmetry.MapPiece(move) : symmetry.MapField(move)];
+    }
+    return stats;
+}
@@ -0,0 +1,90 @@
+#ifndef POSITION_DB_H_INCLUDED
+#define POSITION_DB_H_INCLUDED
+
+#include "enhanced_state.h"
+#include "symmetry.h"
+
+#include <stdint.h>
+
+#include <array>
+#include <optional>
+#include <string>
+
+// Binary format for position statistics gathered from recorded games.
+//
+// A file consists of a 16-byte header followed by fixed-size records, sorted
+// by position key (see PositionKey::operator<), in little-endian byte order.
+// Positions are canonicalized with CanonicalKey(), so all positions that are
+// equivalent under symmetry share one record, and the moves are mapped
+// accordingly. The file is memory-mapped and searched in place, so it can be
+// much larger than the memory available.
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__,
+        "position statistics are stored in native little-endian byte order");
+
+struct PositionDbHeader {
+    char magic[8];         // "QRTOPDB1"
+    uint32_t record_size;  // sizeof(PositionStatsRecord)
+    uint32_t reserved;
+};
+
+static_assert(sizeof(PositionDbHeader) == 16);
+
+struct PositionStatsRecord {
+    // Canonical position, as in PositionKey.
+    uint64_t board;
+    uint16_t occupied;
+    int8_t next_piece;
+    uint8_t reserved;
+
+    // Number of games that reached the position, and how many of them were
+    // won or drawn by the player to move. Counts saturate at UINT32_MAX.
+    uint32_t games;
+    uint32_t wins;
+    uint32_t draws;
+
+    // Number of times each move was played, indexed by canonical piece
+    // number (if a piece must be selected) or canonical field number.
+    uint32_t moves[16];
+
+    PositionKey Key() const { return PositionKey{board, occupied, next_piece}; }
+};
+
+static_assert(sizeof(PositionStatsRecord) == 88);
+
+extern const PositionDbHeader position_db_header;
+
+// Statistics of a position, with moves indexed by the position's own piece or
+// field numbers.
+struct PositionStats {
+    uint32_t games = 0, wins = 0, draws = 0;
+    std::array<uint32_t, 16> moves = {};
+
+    uint32_t Losses() const { return games - wins - draws; }
+};
+
+// Read-only, memory-mapped position statistics file.
+class PositionDatabase {
+public:
+    // Maps the file. Check Ok() afterwards.
+    explicit PositionDatabase(const std::string &path);
+    ~PositionDatabase();
+
+    PositionDatabase(const PositionDatabase&) = delete;
+    PositionDatabase &operator=(const PositionDatabase&) = delete;
+
+    bool Ok() const { return data != nullptr; }
+    size_t size() const { return num_records; }
+
+    // Returns the statistics of the position (or any equivalent position), if
+    // it occurred in the games. Safe to call from multiple threads.
+    std::optional<PositionStats> Lookup(const EnhancedState &est) const;
+
+private:
+    void *data = nullptr;
+    size_t length = 0;
+    const PositionStatsRecord *records = nullptr;
+    size_t num_records = 0;
+};
+
+#endif /* ndef POSITION_DB_H_INCLUDED */
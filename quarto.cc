@@ -7,35 +7,6 @@ namespace {
 using internal::CheckPiece;
 using internal::CheckField;
 
-// winning_lines[] encodes the horizontal, vertical and diagonal lines on the
-// board along which a Quarto can be formed.
-//
-// Each winning line consists of exactly four fields. Each field participates in
-// two or three winning lines, depending on whether the field lies on a diagonal
-// or not.
-//
-// The array below encodes the winning lines for each of 16 fields into a 64 bit
-// integer, where each group of 12 bits encodes the indices of three other
-// fields that are part of the same line (in addition to the field itself).
-//
-// For example, field 0 can form a winning line with fields 1, 2 and 3
-// (horizontally) or 4, 8, and 12 (vertically), or 5, 10, 15 (diagonally),
-// so the first element is 0xfa5c84321.
-static const unsigned long long winning_lines[16] = {
-    0xfa5c84321, 0x000d95320, 0x000ea6310, 0xc96fb7210,
-    0x000c80765, 0xfa0d91764, 0xc93ea2754, 0x000fb3654,
-    0x000c40ba9, 0xc63d51ba8, 0xf50e62b98, 0x000f73a98,
-    0x963840fed, 0x000951fec, 0x000a62fdc, 0xa50b73edc };
-
-// Pieces have four attributes (color, height, etc.) each of which has two
-// possible values (black/white, short/tall, etc.) This function takes a piece
-// number (a 4-bit integer) and returns an 8-bit bitmask with exactly 4 bits
-// set, corresponding with the attribute values for this piece.
-constexpr unsigned GetAttributeValues(int piece) {
-    assert(piece >= 0 && piece < 16);
-    return (piece << 4) | (piece ^ 0xf);
-}
-
 }  //namespace
 
 bool State::IsValid(Move move) const {
@@ -64,21 +35,12 @@ bool State::IsValid(Move move) const {
 bool State::IsQuartoPossible() const {
     if (num_moves < 8 || Over()) return false;
     assert(last_field >= 0);
-    int first_piece = fields[last_field];
-    assert(first_piece >= 0);
-    for (unsigned long long lines = winning_lines[last_field]; lines != 0;
-            lines >>= 12) {
-        unsigned line = lines & 0xfff;
-        unsigned common_attributes = GetAttributeValues(first_piece);
-        int n = 3;
-        for (; n > 0; --n) {
-            int next_piece = fields[line & 0xf];
-            if (next_piece < 0) break;  // next_field unoccupied
-            common_attributes &= GetAttributeValues(next_piece);
-            if (common_attributes == 0) break;  // no attribute in common
-            line >>= 4;
-        }
-        if (n == 0) {
+    assert(est.fields[last_field] >= 0);
+    // A quarto must include the last field. Lines through it that are full
+    // and still have a common attribute value form a quarto.
+    for (const signed char *p = lines_per_field[last_field]; *p >= 0; ++p) {
+        const LineInfo &line = est.lines[*p];
+        if (line.spaces_left == 0 && line.common_values != 0) {
             return true;
         }
     }
@@ -127,11 +89,12 @@ void State::ExecuteValid(Move move) {
     switch (move.GetType()) {
     case Move::Type::SELECT:
         last_piece = move.SelectedPiece();
-        pieces[last_piece] = false;
+        Select(est, last_piece);
         break;
     case Move::Type::PLACE:
         last_field = move.PlacedField();
-        fields[last_field] = CheckPiece(last_piece);
+        assert(est.next_piece == CheckPiece(last_piece));
+        Place(est, last_field);
         break;
     case Move::Type::QUARTO:
         quarto = true;
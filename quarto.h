@@ -1,6 +1,8 @@
 #ifndef QUARTO_H_INCLUDED
 #define QUARTO_H_INCLUDED
 
+#include "enhanced_state.h"
+
 #include <assert.h>
 
 #include <array>
@@ -51,9 +53,9 @@ public:
     Move(const Move&) = default;
     Move& operator=(const Move&) = default;
 
-    Type GetType() { return type; }
-    int SelectedPiece() { return type == Type::SELECT ? piece : -1; }
-    int PlacedField() { return type == Type::PLACE ? field : -1; }
+    Type GetType() const { return type; }
+    int SelectedPiece() const { return type == Type::SELECT ? piece : -1; }
+    int PlacedField() const { return type == Type::PLACE ? field : -1; }
 
 private:
     Move(Type type) : type(type) {}
@@ -77,9 +79,9 @@ public:
     int NextPlayer() const { return ((num_moves + 1) >> 1) & 1; }
     bool Over() const { return quarto || num_moves >= 34; }
     int Winner() const { return quarto ? PreviousPlayer() : -1; }
-    bool Empty(int field) const { return fields[internal::CheckField(field)] < 0; }
-    int PieceAt(int field) const { return fields[internal::CheckField(field)]; }
-    bool Available(int piece) const { return pieces[internal::CheckPiece(piece)]; }
+    bool Empty(int field) const { return est.fields[internal::CheckField(field)] < 0; }
+    int PieceAt(int field) const { return est.fields[internal::CheckField(field)]; }
+    bool Available(int piece) const { return est.pieces & (1 << internal::CheckPiece(piece)); }
     int LastField() const { return last_field; }
     int LastPiece() const { return last_piece; }
     inline ::NextAction NextAction() const;
@@ -87,12 +89,16 @@ public:
     bool IsQuartoPossible() const;
     std::vector<Move> ListValidMoves() const;
 
+    // Returns the position as used by the search algorithms. Only meaningful
+    // when the next action is to select or place a piece.
+    const EnhancedState &Enhanced() const { return est; }
+
     // Update the game state.
     void ExecuteValid(Move move);
     bool Execute(Move move);
 
 private:
-    inline State();
+    State() = default;
 
     // Number of moves played so far. 0 through 34 (inclusive).
     // Selecting a piece and placing it count as separate moves.
@@ -113,12 +119,9 @@ private:
     // True if quarto has been found.
     bool quarto = false;
 
-    // Fields of the board. Each element is the number of the piece occupying
-    // this field (between 0 and 16, inclusive), or -1 if the field is empty.
-    std::array<signed char, 16> fields;
-
-    // Available pieces.
-    std::array<bool, 16> pieces;
+    // Fields of the board, the available pieces, the piece to place next and
+    // the state of each line, which are all updated incrementally.
+    EnhancedState est;
 };
 
 NextAction State::NextAction() const {
@@ -126,9 +129,4 @@ NextAction State::NextAction() const {
             ((num_moves + 1) & 1) ? NextAction::SELECT : NextAction::PLACE;
 }
 
-State::State() {
-    fields.fill(-1);
-    pieces.fill(true);
-}
-
 #endif /* ndef QUARTO_H_INCLUDED */
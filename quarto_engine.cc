@@ -0,0 +1,107 @@
+#include "quarto_engine.h"
+
+#include "quarto.h"
+#include "ai_mcts.h"
+#include "enhanced_state.h"
+#include "notation.h"
+
+#include <string.h>
+
+#include <new>
+
+struct quarto_engine {
+    explicit quarto_engine(unsigned seed) : context(seed), ai(state, context) {
+        ai.SetVerbose(false);
+    }
+
+    SearchContext context;
+    State state = State::Initial();
+    AiMcts ai;
+};
+
+namespace {
+
+void StartGame(quarto_engine *engine, const State &state, unsigned seed) {
+    engine->state = state;
+    engine->ai.Reset(state);
+    engine->context.Reset(seed);
+}
+
+// Builds a state with the given pieces on the board, by selecting and placing
+// them one by one.
+std::optional<State> StateFromBits(uint64_t board, uint16_t occupied, int next_piece) {
+    State state = State::Initial();
+    for (int field = 0; field < 16; ++field) {
+        if ((occupied & (1 << field)) == 0) continue;
+        int piece = (board >> (4*field)) & 15;
+        if (!state.Execute(Move::Select(piece)) || !state.Execute(Move::Place(field))) {
+            return std::nullopt;
+        }
+    }
+    if (next_piece >= 0 && (next_piece > 15 || !state.Execute(Move::Select(next_piece)))) {
+        return std::nullopt;
+    }
+    for (const LineInfo &line : state.Enhanced().lines) {
+        if (line.spaces_left == 0 && line.common_values != 0) return std::nullopt;
+    }
+    return state;
+}
+
+}  // namespace
+
+extern "C" {
+
+quarto_engine *quarto_engine_create(unsigned seed, size_t reserved_nodes) {
+    quarto_engine *engine = new (std::nothrow) quarto_engine(seed);
+    if (engine && reserved_nodes > 0) engine->context.Reserve(reserved_nodes);
+    return engine;
+}
+
+void quarto_engine_destroy(quarto_engine *engine) {
+    delete engine;
+}
+
+int quarto_engine_new_game(quarto_engine *engine, const char *position, unsigned seed) {
+    std::optional<State> state = DecodeState(position ? position : "");
+    if (!state) return -1;
+    StartGame(engine, *state, seed);
+    return 0;
+}
+
+int quarto_engine_new_game_bits(quarto_engine *engine, uint64_t board, uint16_t occupied,
+        int next_piece, unsigned seed) {
+    std::optional<State> state = StateFromBits(board, occupied, next_piece);
+    if (!state) return -1;
+    StartGame(engine, *state, seed);
+    return 0;
+}
+
+int quarto_engine_play(quarto_engine *engine, char move) {
+    std::optional<Move> decoded = DecodeMove(move);
+    if (!decoded || !engine->state.Execute(*decoded)) return -1;
+    engine->ai.Execute(*decoded);
+    return 0;
+}
+
+int quarto_engine_search(quarto_engine *engine, int64_t max_iterations, int64_t max_milliseconds) {
+    if (engine->state.Over()) return -1;
+    SearchBudget budget;
+    budget.max_iterations = max_iterations > 0 ? max_iterations : 0;
+    budget.max_time = std::chrono::milliseconds(max_milliseconds > 0 ? max_milliseconds : 0);
+    std::shared_ptr<SearchHandle> search = engine->ai.PrepareSearch(budget);
+    while (search->RunSlice(1000)) {}
+    return EncodeMove(search->Wait());
+}
+
+int quarto_engine_position(const quarto_engine *engine, char *buffer, size_t size) {
+    std::string position = EncodeState(engine->state);
+    if (position.size() >= size) return -1;
+    memcpy(buffer, position.c_str(), position.size() + 1);
+    return position.size();
+}
+
+size_t quarto_engine_node_capacity(const quarto_engine *engine) {
+    return engine->context.NodeCapacity();
+}
+
+}  // extern "C"
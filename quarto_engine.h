@@ -0,0 +1,71 @@
+#ifndef QUARTO_ENGINE_H_INCLUDED
+#define QUARTO_ENGINE_H_INCLUDED
+
+/* C interface to the Monte Carlo search, for embedding the engine in other
+ * programs. Link with libquarto.a or libquarto.so.
+ *
+ * An engine owns a search context (node memory and a random number generator)
+ * that is reused across games: starting a new game frees the previous search
+ * tree into the engine's node pool, rather than returning it to the system.
+ * Creating one engine per thread and reusing it for many games is much
+ * cheaper than creating an engine per game.
+ *
+ * Moves are compactly encoded as single characters: '0'-'f' select a piece,
+ * 'g'-'v' place on a field, 'w' calls quarto and 'x' passes. Positions are
+ * strings of such moves, replayed from the initial state.
+ *
+ * An engine must not be used by multiple threads at the same time, but
+ * different engines are independent. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct quarto_engine quarto_engine;
+
+/* Creates an engine with memory for `reserved_nodes` search nodes allocated
+ * in advance (more are allocated as needed). Returns NULL on failure. */
+quarto_engine *quarto_engine_create(unsigned seed, size_t reserved_nodes);
+
+void quarto_engine_destroy(quarto_engine *engine);
+
+/* Starts a new game from the given position (NULL or "" for the initial
+ * state), and reseeds the random number generator. Returns 0 on success, or
+ * -1 if the position is invalid. */
+int quarto_engine_new_game(quarto_engine *engine, const char *position, unsigned seed);
+
+/* Like quarto_engine_new_game(), but takes the position as bitmasks: `board`
+ * holds the piece number of each field in 4 bits (field 0 in the lowest
+ * bits), `occupied` has a bit set for each occupied field, and `next_piece` is
+ * the piece to be placed, or -1 if a piece must be selected. Positions with
+ * four-in-a-row are rejected. */
+int quarto_engine_new_game_bits(quarto_engine *engine, uint64_t board, uint16_t occupied,
+        int next_piece, unsigned seed);
+
+/* Executes a compactly encoded move. Returns 0 on success, or -1 if the move
+ * is invalid. */
+int quarto_engine_play(quarto_engine *engine, char move);
+
+/* Searches the current position for at most `max_iterations` iterations
+ * and `max_milliseconds` milliseconds (0 means no limit; if both are 0, the
+ * engine's default number of iterations is used). Returns the best move found
+ * as a compactly encoded character, or -1 if the game is over. The move is not
+ * executed. */
+int quarto_engine_search(quarto_engine *engine, int64_t max_iterations, int64_t max_milliseconds);
+
+/* Writes the current position as a nul-terminated compact string into
+ * `buffer` (at most 35 bytes are needed). Returns the length of the string,
+ * or -1 if the buffer is too small. */
+int quarto_engine_position(const quarto_engine *engine, char *buffer, size_t size);
+
+/* Number of search nodes there is memory for. */
+size_t quarto_engine_node_capacity(const quarto_engine *engine);
+
+#ifdef __cplusplus
+}  /* extern "C" */
+#endif
+
+#endif /* ndef QUARTO_ENGINE_H_INCLUDED */
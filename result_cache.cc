@@ -0,0 +1,316 @@
+#include "result_cache.h"
+
+#include "notation.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <type_traits>
+
+namespace {
+
+// Cache files start with this, followed by the entries of each shard from the
+// least to the most recently used one, in native byte order.
+const char file_magic[8] = {'Q', 'R', 'T', 'O', 'R', 'C', 'H', '2'};
+
+// 64-bit FNV-1a, which (unlike std::hash) is the same in every build, as it
+// must be for keys saved in files.
+uint64_t HashString(const std::string &s) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (unsigned char c : s) h = (h ^ c) * 0x100000001b3ULL;
+    return h;
+}
+
+Move MapMove(const Symmetry &symmetry, Move move) {
+    switch (move.GetType()) {
+    case Move::Type::SELECT: return Move::Select(symmetry.MapPiece(move.SelectedPiece()));
+    case Move::Type::PLACE: return Move::Place(symmetry.MapField(move.PlacedField()));
+    default: return move;
+    }
+}
+
+Move UnmapMove(const Symmetry &symmetry, Move move) {
+    switch (move.GetType()) {
+    case Move::Type::SELECT: return Move::Select(symmetry.UnmapPiece(move.SelectedPiece()));
+    case Move::Type::PLACE: return Move::Place(symmetry.UnmapField(move.PlacedField()));
+    default: return move;
+    }
+}
+
+CachedResult MapResult(const CachedResult &result, Move (*map)(const Symmetry&, Move),
+        const Symmetry &symmetry) {
+    CachedResult mapped = result;
+    mapped.best_move = map(symmetry, result.best_move);
+    for (MoveStats &stats : mapped.moves) stats.move = map(symmetry, stats.move);
+    return mapped;
+}
+
+template<class T>
+void Put(std::ostream &os, const T &value) {
+    static_assert(std::is_trivially_copyable<T>::value);
+    os.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template<class T>
+bool Get(std::istream &is, T &value) {
+    static_assert(std::is_trivially_copyable<T>::value);
+    return bool(is.read(reinterpret_cast<char*>(&value), sizeof(value)));
+}
+
+void PutMove(std::ostream &os, Move move) { Put(os, EncodeMove(move)); }
+
+std::optional<Move> GetMove(std::istream &is) {
+    char ch;
+    if (!Get(is, ch)) return std::nullopt;
+    std::optional<Move> move = DecodeMove(ch);
+    if (!move || (move->GetType() != Move::Type::SELECT && move->GetType() != Move::Type::PLACE)) {
+        return std::nullopt;
+    }
+    return move;
+}
+
+void PutValue(std::ostream &os, std::optional<int> value) {
+    Put(os, static_cast<int8_t>(value ? *value : -2));
+}
+
+bool GetValue(std::istream &is, std::optional<int> &value) {
+    int8_t v;
+    if (!Get(is, v) || v < -2 || v > 1) return false;
+    value = v == -2 ? std::nullopt : std::optional<int>(v);
+    return true;
+}
+
+}  // namespace
+
+std::optional<CachedResult> ResultOfSearch(const AiMcts &ai, Move best_move) {
+    if (best_move.GetType() != Move::Type::SELECT && best_move.GetType() != Move::Type::PLACE) {
+        return std::nullopt;
+    }
+    CachedResult result{best_move, 0, ai.RootValue(), ai.RootStats()};
+    auto it = std::find_if(result.moves.begin(), result.moves.end(), [best_move](const MoveStats &s) {
+        return EncodeMove(s.move) == EncodeMove(best_move);
+    });
+    if (it == result.moves.end()) return std::nullopt;
+    // The statistics are from the perspective of the player to move after the
+    // move, who is the opponent after selecting a piece.
+    const int sign = best_move.GetType() == Move::Type::SELECT ? -1 : 1;
+    if (result.value) {
+        result.expected_value = *result.value;
+    } else if (it->fixed_value) {
+        result.expected_value = sign * *it->fixed_value;
+    } else if (it->visits > 0) {
+        result.expected_value = sign * (1.0 * (it->wins - it->losses) / it->visits);
+    }
+    return result;
+}
+
+uint64_t ResultCache::Key::Hash() const {
+    uint64_t x = position.Hash() ^ (iterations * 0x9e3779b97f4a7c15ULL) ^
+            (milliseconds * 0xc2b2ae3d27d4eb4fULL) ^ configuration;
+    x = (x ^ (x >> 31)) * 0xbf58476d1ce4e5b9ULL;
+    return x ^ (x >> 29);
+}
+
+ResultCache::ResultCache(size_t max_bytes, const std::string &configuration)
+        : max_shard_bytes(max_bytes / num_shards), configuration(HashString(configuration)),
+          shards(new Shard[num_shards]) {}
+
+bool ResultCache::Cacheable(const State &state) {
+    NextAction action = state.NextAction();
+    return (action == NextAction::SELECT || action == NextAction::PLACE) && !state.IsQuartoPossible();
+}
+
+ResultCache::Key ResultCache::MakeCacheKey(const State &state, const SearchBudget &budget,
+        Symmetry *symmetry) const {
+    return Key{CanonicalKey(state.Enhanced(), symmetry), budget.max_iterations, budget.max_time.count(),
+            configuration};
+}
+
+size_t ResultCache::EntryBytes(const Entry &entry) {
+    // Roughly the list node, the index node and bucket, and the moves.
+    return sizeof(Entry) + 2*sizeof(void*) + sizeof(Key) + 4*sizeof(void*) +
+            entry.result.moves.capacity() * sizeof(MoveStats);
+}
+
+std::optional<CachedResult> ResultCache::Lookup(const State &state, const SearchBudget &budget) {
+    if (!Cacheable(state)) return std::nullopt;
+    Symmetry symmetry;
+    const Key key = MakeCacheKey(state, budget, &symmetry);
+    Shard &shard = ShardFor(key);
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(key);
+    if (it == shard.index.end()) {
+        lock.unlock();
+        ++misses;
+        return std::nullopt;
+    }
+    shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+    CachedResult canonical = it->second->result;
+    lock.unlock();
+    ++hits;
+    return MapResult(canonical, UnmapMove, symmetry);
+}
+
+void ResultCache::Store(const State &state, const SearchBudget &budget, const CachedResult &result) {
+    if (!Cacheable(state)) return;
+    Symmetry symmetry;
+    const Key key = MakeCacheKey(state, budget, &symmetry);
+    Insert(Entry{key, MapResult(result, MapMove, symmetry)});
+    ++stores;
+}
+
+void ResultCache::Insert(Entry entry) {
+    entry.result.moves.shrink_to_fit();
+    const size_t bytes = EntryBytes(entry);
+    if (bytes > max_shard_bytes) return;
+    Shard &shard = ShardFor(entry.key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(entry.key);
+    if (it != shard.index.end()) {
+        shard.bytes -= EntryBytes(*it->second);
+        shard.entries.erase(it->second);
+        shard.index.erase(it);
+    }
+    while (shard.bytes + bytes > max_shard_bytes) {
+        const Entry &oldest = shard.entries.back();
+        shard.bytes -= EntryBytes(oldest);
+        shard.index.erase(oldest.key);
+        shard.entries.pop_back();
+    }
+    shard.entries.push_front(std::move(entry));
+    shard.index[shard.entries.front().key] = shard.entries.begin();
+    shard.bytes += bytes;
+}
+
+size_t ResultCache::size() const {
+    size_t n = 0;
+    for (int i = 0; i < num_shards; ++i) {
+        std::lock_guard<std::mutex> lock(shards[i].mutex);
+        n += shards[i].entries.size();
+    }
+    return n;
+}
+
+size_t ResultCache::Bytes() const {
+    size_t n = 0;
+    for (int i = 0; i < num_shards; ++i) {
+        std::lock_guard<std::mutex> lock(shards[i].mutex);
+        n += shards[i].bytes;
+    }
+    return n;
+}
+
+bool ResultCache::Load(const std::string &path) {
+    std::ifstream is(path, std::ios::binary);
+    if (!is) return true;  // nothing saved yet
+    char magic[sizeof(file_magic)];
+    if (!is.read(magic, sizeof(magic)) || memcmp(magic, file_magic, sizeof(magic)) != 0) {
+        std::cerr << path << ": not a result cache file" << std::endl;
+        return false;
+    }
+    for (;;) {
+        Key key;
+        if (!Get(is, key.position.board)) break;  // end of file
+        std::optional<Move> best_move;
+        CachedResult result{Move::Quarto(), 0, std::nullopt, {}};
+        uint8_t num_moves;
+        bool ok = Get(is, key.position.occupied) && Get(is, key.position.next_piece) &&
+                Get(is, key.iterations) && Get(is, key.milliseconds) && Get(is, key.configuration) &&
+                (best_move = GetMove(is)) && Get(is, result.expected_value) &&
+                GetValue(is, result.value) && Get(is, num_moves) && num_moves <= 16;
+        result.best_move = best_move.value_or(Move::Quarto());
+        for (int i = 0; ok && i < num_moves; ++i) {
+            std::optional<Move> move = GetMove(is);
+            MoveStats stats = {move.value_or(Move::Quarto()), 0, 0, 0, std::nullopt};
+            ok = move && Get(is, stats.visits) && Get(is, stats.wins) && Get(is, stats.losses) &&
+                    GetValue(is, stats.fixed_value);
+            result.moves.push_back(stats);
+        }
+        if (!ok) {
+            std::cerr << path << ": truncated or corrupt result cache file" << std::endl;
+            return false;
+        }
+        Insert(Entry{key, std::move(result)});
+    }
+    return true;
+}
+
+bool ResultCache::Save(const std::string &path) const {
+    const std::string temp_path = path + ".tmp";
+    std::ofstream os(temp_path, std::ios::binary);
+    if (!os) {
+        perror(temp_path.c_str());
+        return false;
+    }
+    os.write(file_magic, sizeof(file_magic));
+    for (int i = 0; i < num_shards; ++i) {
+        std::lock_guard<std::mutex> lock(shards[i].mutex);
+        for (auto it = shards[i].entries.rbegin(); it != shards[i].entries.rend(); ++it) {
+            const Key &key = it->key;
+            const CachedResult &result = it->result;
+            Put(os, key.position.board);
+            Put(os, key.position.occupied);
+            Put(os, key.position.next_piece);
+            Put(os, key.iterations);
+            Put(os, key.milliseconds);
+            Put(os, key.configuration);
+            PutMove(os, result.best_move);
+            Put(os, result.expected_value);
+            PutValue(os, result.value);
+            Put(os, static_cast<uint8_t>(result.moves.size()));
+            for (const MoveStats &stats : result.moves) {
+                PutMove(os, stats.move);
+                Put(os, stats.visits);
+                Put(os, stats.wins);
+                Put(os, stats.losses);
+                PutValue(os, stats.fixed_value);
+            }
+        }
+    }
+    os.close();
+    if (!os) {
+        std::cerr << "Could not write " << temp_path << std::endl;
+        return false;
+    }
+    if (rename(temp_path.c_str(), path.c_str()) != 0) {
+        perror(path.c_str());
+        return false;
+    }
+    return true;
+}
+
+CacheSaver::CacheSaver(ResultCache *cache, const std::string &path, bool background)
+        : cache(path.empty() ? nullptr : cache), path(path),
+          saved_stores(cache ? cache->Stores() : 0), last_save(std::chrono::steady_clock::now()) {
+    if (!this->cache || !background) return;
+    thread = std::thread([this]{
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stop_requested.wait_for(lock, interval, [this]{ return stopping; })) Save();
+    });
+}
+
+CacheSaver::~CacheSaver() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    stop_requested.notify_all();
+    if (thread.joinable()) thread.join();
+    std::lock_guard<std::mutex> lock(mutex);
+    Save();
+}
+
+void CacheSaver::SaveIfDue() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (std::chrono::steady_clock::now() - last_save >= interval) Save();
+}
+
+void CacheSaver::Save() {
+    if (!cache || cache->Stores() == saved_stores) return;
+    saved_stores = cache->Stores();
+    last_save = std::chrono::steady_clock::now();
+    cache->Save(path);
+}
@@ -0,0 +1,167 @@
+#ifndef RESULT_CACHE_H_INCLUDED
+#define RESULT_CACHE_H_INCLUDED
+
+#include "quarto.h"
+#include "ai.h"
+#include "ai_mcts.h"
+#include "symmetry.h"
+
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// The outcome of a finished search, which can be returned again when the same
+// position is searched with the same budget.
+struct CachedResult {
+    Move best_move;
+
+    // Estimated value for the player to move, between -1 and +1.
+    double expected_value;
+
+    // Value for the player to move (-1, 0 or +1), if the search proved it.
+    std::optional<int> value;
+
+    // Statistics of the moves from the root (the visit distribution).
+    std::vector<MoveStats> moves;
+
+    bool Solved() const { return value.has_value(); }
+};
+
+// Collects the result of the search that `ai` finished with `best_move`.
+// Returns std::nullopt if the move wasn't found by searching (e.g. calling
+// quarto), so there is nothing worth caching.
+std::optional<CachedResult> ResultOfSearch(const AiMcts &ai, Move best_move);
+
+// A memory-bounded cache of search results, keyed by canonical position (see
+// CanonicalKey()), search budget and search configuration, so that the
+// results can be reused for all positions that are equivalent under symmetry.
+// The least recently used results are evicted first.
+//
+// All methods are thread-safe. Entries are spread over independently locked
+// shards, so that concurrent lookups rarely wait for each other.
+class ResultCache {
+public:
+    // Keeps results taking up to about `max_bytes` of memory. `configuration`
+    // describes everything besides the position and budget that the results
+    // depend on (e.g. the AI's type and parameters). Only results stored with
+    // the same configuration are found, so a cache file can be shared by
+    // several configurations.
+    explicit ResultCache(size_t max_bytes, const std::string &configuration = "");
+
+    ResultCache(const ResultCache&) = delete;
+    ResultCache &operator=(const ResultCache&) = delete;
+
+    // Whether results for the state can be cached: a piece must be selected
+    // or placed, and there's no quarto to call.
+    static bool Cacheable(const State &state);
+
+    // Returns the result for the state and budget, with moves in the state's
+    // own coordinates, and marks it as recently used.
+    std::optional<CachedResult> Lookup(const State &state, const SearchBudget &budget);
+
+    // Adds or replaces the result for the state and budget.
+    void Store(const State &state, const SearchBudget &budget, const CachedResult &result);
+
+    // Adds the results saved in a file, which need not exist yet. Returns
+    // false if the file can't be read.
+    bool Load(const std::string &path);
+
+    // Saves all results, replacing the file atomically.
+    bool Save(const std::string &path) const;
+
+    size_t size() const;
+    size_t Bytes() const;
+
+    uint64_t Hits() const { return hits; }
+    uint64_t Misses() const { return misses; }
+
+    // Number of results stored so far, e.g. to see if the cache has changed.
+    uint64_t Stores() const { return stores; }
+
+private:
+    struct Key {
+        PositionKey position;  // canonical
+        int64_t iterations;
+        int64_t milliseconds;
+        uint64_t configuration;  // hash of the configuration
+
+        bool operator==(const Key &k) const {
+            return position == k.position && iterations == k.iterations &&
+                    milliseconds == k.milliseconds && configuration == k.configuration;
+        }
+        uint64_t Hash() const;
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key &k) const { return k.Hash(); }
+    };
+
+    // Moves are stored in canonical coordinates.
+    struct Entry {
+        Key key;
+        CachedResult result;
+    };
+
+    // Most recently used entries first.
+    struct Shard {
+        mutable std::mutex mutex;
+        std::list<Entry> entries;
+        std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index;
+        size_t bytes = 0;
+    };
+
+    static constexpr int num_shards = 16;
+
+    Key MakeCacheKey(const State &state, const SearchBudget &budget, Symmetry *symmetry) const;
+    static size_t EntryBytes(const Entry &entry);
+    Shard &ShardFor(const Key &key) { return shards[key.Hash() % num_shards]; }
+    void Insert(Entry entry);
+
+    const size_t max_shard_bytes;
+    const uint64_t configuration;
+    std::unique_ptr<Shard[]> shards;
+    std::atomic<uint64_t> hits{0}, misses{0}, stores{0};
+};
+
+// Saves a result cache to its file when results were added: by SaveIfDue()
+// at most once a minute, and a last time when the saver is destroyed. With
+// `background`, a thread of its own calls SaveIfDue() until then, for
+// programs that store results from other threads. Does nothing if either the
+// cache or the path is empty.
+class CacheSaver {
+public:
+    CacheSaver(ResultCache *cache, const std::string &path, bool background = false);
+    ~CacheSaver();
+
+    CacheSaver(const CacheSaver&) = delete;
+    CacheSaver &operator=(const CacheSaver&) = delete;
+
+    void SaveIfDue();
+
+private:
+    static constexpr std::chrono::minutes interval{1};
+
+    void Save();  // with `mutex` held
+
+    ResultCache *const cache;
+    const std::string path;
+
+    std::mutex mutex;
+    uint64_t saved_stores;
+    std::chrono::steady_clock::time_point last_save;
+    std::condition_variable stop_requested;
+    bool stopping = false;
+    std::thread thread;
+};
+
+#endif /* ndef RESULT_CACHE_H_INCLUDED */
@@ -0,0 +1,196 @@
+// Plays games of the AI against itself, and records the searched positions as
+// training data.
+//
+// Usage: quarto-selfplay [<options>] --output=<file>
+//        quarto-selfplay --summary=<file>
+
+#include "quarto.h"
+#include "ai_mcts.h"
+#include "symmetry.h"
+#include "training_data.h"
+
+#include <stdlib.h>
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Options {
+    int64_t games = 100;
+    int threads = 1;
+    int iterations = 10000;
+    int sampled_moves = 8;
+    AiMctsConfig config;
+    std::string output;
+};
+
+// Picks one of the searched moves with probability proportional to its
+// number of visits, to diversify the opening.
+Move SampleMove(const std::vector<MoveStats> &stats, Move fallback, std::mt19937 &rng) {
+    int64_t total = 0;
+    for (const MoveStats &s : stats) total += s.visits;
+    if (total <= 0) return fallback;
+    int64_t r = std::uniform_int_distribution<int64_t>(0, total - 1)(rng);
+    for (const MoveStats &s : stats) {
+        if (r < s.visits) return s.move;
+        r -= s.visits;
+    }
+    return fallback;
+}
+
+// Plays one game and appends its records to `records`.
+void PlayGame(const Options &options, std::mt19937 &rng, std::vector<TrainingRecord> &records) {
+    State state = State::Initial();
+    AiMcts ai(state, rng(), options.config);
+    ai.SetVerbose(false);
+    const size_t first_record = records.size();
+    std::vector<int> players;  // player to move for each record
+    for (int move_number = 0; !state.Over(); ++move_number) {
+        std::shared_ptr<SearchHandle> search = ai.PrepareSearch(SearchBudget{options.iterations});
+        while (search->RunSlice(options.iterations)) {}
+        Move move = search->Wait();
+        if (search->Iterations() > 0) {
+            std::vector<MoveStats> stats = ai.RootStats();
+            if (move_number < options.sampled_moves) move = SampleMove(stats, move, rng);
+
+            const EnhancedState &est = state.Enhanced();
+            PositionKey key = MakeKey(est);
+            TrainingRecord record = {};
+            record.board = key.board;
+            record.occupied = key.occupied;
+            record.next_piece = key.next_piece;
+            record.move_number = move_number;
+            record.move_played = est.next_piece < 0 ? move.SelectedPiece() : move.PlacedField();
+            for (const MoveStats &s : stats) {
+                int index = est.next_piece < 0 ? s.move.SelectedPiece() : s.move.PlacedField();
+                record.visits[index] = s.visits;
+            }
+            records.push_back(record);
+            players.push_back(state.NextPlayer());
+        }
+        state.ExecuteValid(move);
+        ai.Execute(move);
+    }
+    const int winner = state.Winner();
+    for (size_t i = first_record; i < records.size(); ++i) {
+        int player = players[i - first_record];
+        records[i].result = winner < 0 ? 0 : winner == player ? 1 : -1;
+    }
+}
+
+int RunSelfPlay(const Options &options) {
+    TrainingDataWriter writer(options.output);
+    if (!writer.Ok()) return 1;
+    constexpr size_t flush_threshold = 1 << 14;
+    std::atomic<int64_t> next_game{0};
+    std::atomic<bool> failed{false};
+    std::random_device dev;
+    std::vector<std::thread> threads;
+    auto start_time = std::chrono::steady_clock::now();
+    for (int t = 0; t < options.threads; ++t) {
+        unsigned seed = dev();
+        threads.emplace_back([&, seed]{
+            std::mt19937 rng(seed);
+            std::vector<TrainingRecord> records;
+            records.reserve(flush_threshold + 32);
+            while (!failed && next_game++ < options.games) {
+                PlayGame(options, rng, records);
+                if (records.size() >= flush_threshold) {
+                    if (!writer.Write(records)) failed = true;
+                    records.clear();
+                }
+            }
+            if (!records.empty() && !writer.Write(records)) failed = true;
+        });
+    }
+    for (std::thread &thread : threads) thread.join();
+    if (!writer.Close()) failed = true;
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    std::cerr << "Wrote " << writer.RecordsWritten() << " records from " << options.games
+            << " games in " << seconds << " s" << std::endl;
+    return failed ? 1 : 0;
+}
+
+int PrintSummary(const std::string &path) {
+    MappedTrainingData data(path);
+    if (!data.Ok()) return 1;
+    int64_t results[3] = {0, 0, 0};
+    int64_t games = 0;
+    for (const TrainingRecord &record : data) {
+        ++results[record.result + 1];
+        if (record.move_number == 0) ++games;
+    }
+    std::cout << data.size() << " records (" << games << " games starting from the initial position)\n"
+            << "Results for the player to move: " << results[2] << " won, "
+            << results[1] << " tied, " << results[0] << " lost" << std::endl;
+    return 0;
+}
+
+void PrintUsage(std::ostream &os) {
+    os << "Usage: quarto-selfplay [<options>] --output=<file>\n"
+        "       quarto-selfplay --summary=<file>\n"
+        "\n"
+        "Options:\n"
+        "  --games=<count>        number of games to play (default: 100)\n"
+        "  --threads=<count>      number of games to play in parallel (default: all cores)\n"
+        "  --iterations=<count>   search iterations per move (default: 10000)\n"
+        "  --sampled-moves=<n>    for the first n moves, pick moves in proportion to\n"
+        "                         their visit counts instead of the best move (default: 8)\n"
+        "  --playout-cutoff=<n>   stop playouts after n placements and estimate the\n"
+        "                         outcome with a static evaluation (default: 0, off)\n"
+        "  --output=<file>        file to append records to\n"
+        "  --summary=<file>       print statistics about an existing file\n";
+}
+
+bool ParseOption(const std::string &arg, const std::string &name, std::string &value) {
+    std::string prefix = "--" + name + "=";
+    if (arg.compare(0, prefix.size(), prefix) != 0) return false;
+    value = arg.substr(prefix.size());
+    return true;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+    Options options;
+    options.threads = std::max(1u, std::thread::hardware_concurrency());
+    std::string summary;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        std::string value;
+        if (ParseOption(arg, "games", value)) {
+            options.games = atoll(value.c_str());
+        } else if (ParseOption(arg, "threads", value)) {
+            options.threads = std::max(1, atoi(value.c_str()));
+        } else if (ParseOption(arg, "iterations", value)) {
+            options.iterations = std::max(1, atoi(value.c_str()));
+        } else if (ParseOption(arg, "sampled-moves", value)) {
+            options.sampled_moves = atoi(value.c_str());
+        } else if (ParseOption(arg, "playout-cutoff", value)) {
+            options.config.playout_cutoff_depth = std::max(0, atoi(value.c_str()));
+        } else if (ParseOption(arg, "output", value)) {
+            options.output = value;
+        } else if (ParseOption(arg, "summary", value)) {
+            summary = value;
+        } else if (arg == "-h" || arg == "--help") {
+            PrintUsage(std::cout);
+            return 0;
+        } else {
+            std::cerr << "Unexpected argument: " << arg << '\n';
+            PrintUsage(std::cerr);
+            return 1;
+        }
+    }
+    if (!summary.empty()) return PrintSummary(summary);
+    if (options.output.empty()) {
+        PrintUsage(std::cerr);
+        return 1;
+    }
+    return RunSelfPlay(options);
+}
@@ -0,0 +1,86 @@
+// Engine server that plays many games at once on a shared pool of threads.
+//
+// Usage: quarto-server [<options>]
+//
+// See server.h for the protocol.
+
+#include "server.h"
+#include "result_cache.h"
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+
+namespace {
+
+void PrintUsage(std::ostream &os) {
+    os << "Usage: quarto-server [<options>]\n"
+        "\n"
+        "Options:\n"
+        "  --listen=<address>      unix:<path> or tcp:[<host>]:<port> (default: unix:quarto.sock)\n"
+        "  --threads=<count>       number of search threads (default: all cores)\n"
+        "  --slice=<iterations>    iterations per search before switching to another\n"
+        "                          game (default: 1000)\n"
+        "  --playout-cutoff=<n>    stop playouts after n placements and estimate the\n"
+        "                          outcome with a static evaluation (default: 0, off)\n"
+        "  --cache-size=<MiB>      answer repeated searches from a result cache of this\n"
+        "                          size (default: 0, off; 64 if a cache file is given)\n"
+        "  --cache-file=<file>     load the result cache from a file, and save it there\n"
+        "                          every minute while it changes\n";
+}
+
+bool ParseOption(const std::string &arg, const std::string &name, std::string &value) {
+    std::string prefix = "--" + name + "=";
+    if (arg.compare(0, prefix.size(), prefix) != 0) return false;
+    value = arg.substr(prefix.size());
+    return true;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+    std::string address = "unix:quarto.sock";
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    int slice = 1000;
+    AiMctsConfig config;
+    size_t cache_mib = 0;
+    std::string cache_path;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        std::string value;
+        if (ParseOption(arg, "listen", value)) {
+            address = value;
+        } else if (ParseOption(arg, "threads", value)) {
+            threads = std::max(1, atoi(value.c_str()));
+        } else if (ParseOption(arg, "slice", value)) {
+            slice = std::max(1, atoi(value.c_str()));
+        } else if (ParseOption(arg, "playout-cutoff", value)) {
+            config.playout_cutoff_depth = std::max(0, atoi(value.c_str()));
+        } else if (ParseOption(arg, "cache-size", value)) {
+            cache_mib = std::max(0, atoi(value.c_str()));
+        } else if (ParseOption(arg, "cache-file", value)) {
+            cache_path = value;
+        } else if (arg == "-h" || arg == "--help") {
+            PrintUsage(std::cout);
+            return 0;
+        } else {
+            std::cerr << "Unexpected argument: " << arg << '\n';
+            PrintUsage(std::cerr);
+            return 1;
+        }
+    }
+    if (!cache_path.empty() && cache_mib == 0) cache_mib = 64;
+    std::unique_ptr<ResultCache> cache;
+    if (cache_mib > 0) {
+        cache = std::make_unique<ResultCache>(cache_mib << 20, FormatAiMctsConfig(config));
+        if (!cache_path.empty() && !cache->Load(cache_path)) return 1;
+    }
+    // The server only exits on failure, so save periodically, too.
+    CacheSaver cache_saver(cache.get(), cache_path, true);
+    GameServer server(threads, slice, config, cache.get());
+    return server.Run(address);
+}
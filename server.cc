@@ -0,0 +1,262 @@
+#include "server.h"
+
+#include "net.h"
+#include "notation.h"
+#include "result_cache.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+namespace {
+
+// A client connection. Replies to searches are sent from the pool's threads,
+// so writes are serialized.
+class Connection {
+public:
+    explicit Connection(int fd) : fd(fd) {}
+    ~Connection() { close(fd); }
+
+    Connection(const Connection&) = delete;
+    Connection &operator=(const Connection&) = delete;
+
+    bool Send(const std::string &line) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return WriteAll(fd, line + '\n');
+    }
+
+private:
+    const int fd;
+    std::mutex mutex;
+};
+
+struct Game {
+    Game(const State &state, const AiMctsConfig &config) : state(state), ai(state, config) {
+        ai.SetVerbose(false);
+    }
+
+    bool Searching() const { return search && !search->Done(); }
+
+    State state;
+    AiMcts ai;
+    std::shared_ptr<SearchHandle> search;
+
+    // Whether the client stopped the search, whose result then isn't cached,
+    // or closed the game, so that the result isn't sent either.
+    std::atomic<bool> stopped{false};
+    std::atomic<bool> closed{false};
+
+    // Held while the AI is used: by the pool while it runs a slice of the
+    // search (including the completion callback), and by the connection's
+    // thread while it executes a move or starts a search. Since a search is
+    // marked as done before its callback runs, this is what keeps a new
+    // search from starting while the callback still reads the tree.
+    std::mutex mutex;
+};
+
+std::optional<Move> ParseMoveArgument(const std::string &s) {
+    return s.size() == 1 ? DecodeMove(s[0]) : ParseMove(s);
+}
+
+// The games of a single connection. Only used by the connection's thread.
+class Session {
+public:
+    Session(std::shared_ptr<Connection> connection, SearchPool &pool, const AiMctsConfig &config,
+            ResultCache *cache)
+            : connection(std::move(connection)), pool(pool), config(config), cache(cache) {}
+
+    ~Session() {
+        for (auto &entry : games) {
+            entry.second->stopped = true;
+            if (entry.second->search) entry.second->search->Stop();
+        }
+    }
+
+    // Handles a single request line and returns the response, which may be
+    // empty if it has been sent already.
+    std::string Handle(const std::string &line);
+
+private:
+    std::string StartSearch(int id, Game &game, std::istringstream &args);
+
+    std::shared_ptr<Connection> connection;
+    SearchPool &pool;
+    const AiMctsConfig &config;
+    ResultCache *cache;
+    std::map<int, std::shared_ptr<Game>> games;
+    int next_game_id = 1;
+};
+
+std::string Session::Handle(const std::string &line) {
+    std::istringstream iss(line);
+    std::string command;
+    iss >> command;
+    if (command == "new") {
+        std::string position;
+        iss >> position;
+        if (position == "-") position.clear();
+        std::optional<State> state = DecodeState(position);
+        if (!state) return "error invalid position";
+        int id = next_game_id++;
+        games[id] = std::make_shared<Game>(*state, config);
+        return "ok " + std::to_string(id);
+    }
+
+    int id = 0;
+    if (!(iss >> id)) return "error malformed request";
+    auto it = games.find(id);
+    if (it == games.end()) return "error unknown game";
+    Game &game = *it->second;
+    if (command == "state") {
+        std::string position = EncodeState(game.state);
+        return "state " + std::to_string(id) + ' ' + (position.empty() ? "-" : position);
+    }
+    if (command == "stop") {
+        game.stopped = true;
+        if (game.search) game.search->Stop();
+        return "ok";
+    }
+    if (command == "close") {
+        // A running search keeps the game alive until it notices the request
+        // to stop.
+        game.stopped = true;
+        game.closed = true;
+        if (game.search) game.search->Stop();
+        games.erase(it);
+        return "ok";
+    }
+    if (command != "move" && command != "search") return "error unknown command";
+    std::lock_guard<std::mutex> lock(game.mutex);
+    if (game.Searching()) return "error search in progress";
+    if (command == "search") return StartSearch(id, game, iss);
+
+    std::string move_string;
+    if (!(iss >> move_string)) return "error malformed request";
+    std::optional<Move> move = ParseMoveArgument(move_string);
+    if (!move || !game.state.Execute(*move)) return "error invalid move";
+    game.ai.Execute(*move);
+    return "ok";
+}
+
+std::string Session::StartSearch(int id, Game &game, std::istringstream &args) {
+    if (game.state.Over()) return "error game over";
+    SearchBudget budget;
+    int64_t iterations = 0, milliseconds = 0;
+    if (args >> iterations) args >> milliseconds;
+    if (iterations < 0 || milliseconds < 0) return "error invalid budget";
+    // Spell out the default, so that it's the same key for the cache.
+    budget.max_iterations = iterations == 0 && milliseconds == 0 ? game.ai.IterationsPerMove() : iterations;
+    budget.max_time = std::chrono::milliseconds(milliseconds);
+    if (cache) {
+        if (std::optional<CachedResult> result = cache->Lookup(game.state, budget)) {
+            connection->Send("ok");
+            return "bestmove " + std::to_string(id) + ' ' + EncodeMove(result->best_move);
+        }
+    }
+    game.stopped = false;
+    std::weak_ptr<Connection> weak_connection = connection;
+    // The game is kept alive by the pool while searching, which also holds
+    // its mutex while this runs.
+    Game *searched_game = &game;
+    game.search = game.ai.PrepareSearch(budget, [weak_connection, id, searched_game, cache = cache,
+            state = game.state, budget](Move move) {
+        if (cache && !searched_game->stopped) {
+            if (std::optional<CachedResult> result = ResultOfSearch(searched_game->ai, move)) {
+                cache->Store(state, budget, *result);
+            }
+        }
+        if (searched_game->closed) return;
+        if (std::shared_ptr<Connection> c = weak_connection.lock()) {
+            c->Send("bestmove " + std::to_string(id) + ' ' + EncodeMove(move));
+        }
+    });
+    // Reply first, so the client sees "ok" before the result.
+    connection->Send("ok");
+    pool.Submit(game.search, games[id], &game.mutex);
+    return {};
+}
+
+}  // namespace
+
+SearchPool::SearchPool(int thread_count, int slice_iterations)
+        : slice_iterations(slice_iterations) {
+    for (int i = 0; i < thread_count; ++i) {
+        threads.emplace_back([this]{ Work(); });
+    }
+}
+
+SearchPool::~SearchPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        shutting_down = true;
+        for (Job &job : queue) job.search->Stop();
+    }
+    cv.notify_all();
+    for (std::thread &thread : threads) thread.join();
+}
+
+void SearchPool::Submit(std::shared_ptr<SearchHandle> search, std::shared_ptr<void> owner,
+        std::mutex *ai_mutex) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (shutting_down) search->Stop();
+        queue.push_back(Job{std::move(owner), std::move(search), ai_mutex});
+    }
+    cv.notify_one();
+}
+
+void SearchPool::Work() {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        cv.wait(lock, [this]{ return shutting_down || !queue.empty(); });
+        if (queue.empty()) return;
+        Job job = std::move(queue.front());
+        queue.pop_front();
+        lock.unlock();
+        bool more;
+        if (job.ai_mutex) {
+            std::lock_guard<std::mutex> ai_lock(*job.ai_mutex);
+            more = job.search->RunSlice(slice_iterations);
+        } else {
+            more = job.search->RunSlice(slice_iterations);
+        }
+        // Release finished games without holding the lock.
+        if (!more) job = Job();
+        lock.lock();
+        if (more) queue.push_back(std::move(job));
+    }
+}
+
+GameServer::GameServer(int threads, int slice_iterations, const AiMctsConfig &config,
+        ResultCache *cache)
+        : pool(threads, slice_iterations), config(config), cache(cache) {}
+
+void GameServer::ServeConnection(int fd) {
+    auto connection = std::make_shared<Connection>(fd);
+    Session session(connection, pool, config, cache);
+    LineReader reader(fd);
+    std::string line;
+    while (reader.ReadLine(line)) {
+        if (line.empty()) continue;
+        std::string response = session.Handle(line);
+        if (!response.empty() && !connection->Send(response)) break;
+    }
+}
+
+int GameServer::Run(const std::string &address) {
+    int listen_fd = ListenOn(address);
+    if (listen_fd < 0) return 1;
+    std::cerr << "Server listening on " << address << std::endl;
+    for (;;) {
+        int fd = AcceptConnection(listen_fd);
+        if (fd < 0) {
+            perror("accept");
+            return 1;
+        }
+        std::thread([this, fd]{ ServeConnection(fd); }).detach();
+    }
+}
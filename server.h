@@ -0,0 +1,97 @@
+#ifndef SERVER_H_INCLUDED
+#define SERVER_H_INCLUDED
+
+#include "ai.h"
+#include "ai_mcts.h"
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class ResultCache;
+
+// Runs prepared searches (see Ai::PrepareSearch()) on a fixed number of
+// threads. Searches are advanced one slice at a time in round-robin order, so
+// that long searches don't starve short ones.
+class SearchPool {
+public:
+    SearchPool(int threads, int slice_iterations);
+
+    // Stops all pending searches and waits for the threads to exit.
+    ~SearchPool();
+
+    SearchPool(const SearchPool&) = delete;
+    SearchPool &operator=(const SearchPool&) = delete;
+
+    // Schedules a search. `owner` is kept alive until the search is done, so it
+    // should own the Ai that the search runs on. If `ai_mutex` is given, it's
+    // held while each slice of the search runs (and while the completion
+    // callback runs), and must be owned by `owner`, too.
+    void Submit(std::shared_ptr<SearchHandle> search, std::shared_ptr<void> owner,
+            std::mutex *ai_mutex = nullptr);
+
+private:
+    struct Job {
+        std::shared_ptr<void> owner;
+        std::shared_ptr<SearchHandle> search;
+        std::mutex *ai_mutex;
+    };
+
+    void Work();
+
+    const int slice_iterations;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<Job> queue;
+    bool shutting_down = false;
+    std::vector<std::thread> threads;
+};
+
+// Plays many games at once for clients connected over a socket. Each game has
+// its own state and search tree, but all searches share one SearchPool.
+//
+// The protocol is line-based. Games are numbered per connection, and are
+// deleted when the connection is closed. The client sends:
+//
+//   new [<position>]             start a game; replies "ok <game>"
+//   move <game> <move>           execute a move; replies "ok"
+//   search <game> [<iterations> [<milliseconds>]]
+//                                start a search; replies "ok" now, and
+//                                "bestmove <game> <move>" when it's done
+//   stop <game>                  finish the search early; replies "ok"
+//   state <game>                 replies "state <game> <position>"
+//   close <game>                 delete the game; replies "ok"
+//
+// Positions are compact move strings ("-" for the initial state). Moves are
+// compactly encoded, but may also be written as in the interactive game.
+// Omitted or zero budgets use the AI's default. A game can't be changed while
+// it is being searched. On invalid input the server replies with
+// "error <message>".
+//
+// If a result cache is given, searches of positions that were searched with
+// the same budget before are answered from the cache right away, and the
+// results of searches that weren't stopped are added to it.
+class GameServer {
+public:
+    GameServer(int threads, int slice_iterations, const AiMctsConfig &config = AiMctsConfig(),
+            ResultCache *cache = nullptr);
+
+    // Serves clients on a connected socket until it is closed, and then
+    // closes it.
+    void ServeConnection(int fd);
+
+    // Listens on the given address and serves each client on its own thread.
+    // Only returns on failure.
+    int Run(const std::string &address);
+
+private:
+    SearchPool pool;
+    AiMctsConfig config;
+    ResultCache *cache;
+};
+
+#endif /* ndef SERVER_H_INCLUDED */
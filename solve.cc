@@ -0,0 +1,125 @@
+// Standalone solver that computes the game-theoretic value of a position.
+//
+// Usage: quarto-solve [<options>] [<state>]
+//
+// where <state> is a compact move string as printed by the `history` command
+// of the interactive game.
+
+#include "quarto.h"
+#include "enhanced_state.h"
+#include "notation.h"
+#include "solver.h"
+
+#include <stdlib.h>
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+void PrintUsage(std::ostream &os) {
+    os << "Usage: quarto-solve [<options>] [<state>]\n"
+        "\n"
+        "Options:\n"
+        "  --threads=<count>             number of worker threads (default: all cores)\n"
+        "  --table-bits=<bits>           transposition table has 2^bits entries (default: 24)\n"
+        "  --split-depth=<placements>    depth at which the tree is split into tasks (default: 2)\n"
+        "  --checkpoint=<file>           save and resume progress using this file\n"
+        "  --checkpoint-interval=<secs>  seconds between checkpoints (default: 600)\n"
+        "  --quiet                       don't report progress\n";
+}
+
+bool ParseOption(const std::string &arg, const std::string &name, std::string &value) {
+    std::string prefix = "--" + name + "=";
+    if (arg.compare(0, prefix.size(), prefix) != 0) return false;
+    value = arg.substr(prefix.size());
+    return true;
+}
+
+const char *DescribeValue(int value) {
+    return value > 0 ? "win" : value < 0 ? "loss" : "tie";
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+    Solver::Options options;
+    options.threads = std::thread::hardware_concurrency();
+    options.verbose = true;
+    std::string compact;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        std::string value;
+        if (ParseOption(arg, "threads", value)) {
+            options.threads = atoi(value.c_str());
+        } else if (ParseOption(arg, "table-bits", value)) {
+            options.table_bits = atoi(value.c_str());
+        } else if (ParseOption(arg, "split-depth", value)) {
+            options.split_depth = atoi(value.c_str());
+        } else if (ParseOption(arg, "checkpoint", value)) {
+            options.checkpoint_path = value;
+        } else if (ParseOption(arg, "checkpoint-interval", value)) {
+            options.checkpoint_interval_seconds = atoi(value.c_str());
+        } else if (arg == "--quiet") {
+            options.verbose = false;
+        } else if (arg == "-h" || arg == "--help") {
+            PrintUsage(std::cout);
+            return 0;
+        } else if (arg.compare(0, 2, "--") != 0 && compact.empty()) {
+            compact = arg;
+        } else {
+            std::cerr << "Unexpected argument: " << arg << '\n';
+            PrintUsage(std::cerr);
+            return 1;
+        }
+    }
+
+    std::optional<State> state = DecodeState(compact);
+    if (!state) {
+        std::cerr << "Invalid state: " << compact << std::endl;
+        return 1;
+    }
+    if (state->Over()) {
+        std::cerr << "Game is already over." << std::endl;
+        return 1;
+    }
+    std::cout << "Position: " << (compact.empty() ? "(initial)" : compact) << std::endl;
+
+    // Calling quarto and passing aren't part of the solver's search.
+    if (state->IsQuartoPossible()) {
+        std::cout << "Value: +1 (win)\nBest moves: " << Move::Quarto()
+                << " (" << compact << EncodeMove(Move::Quarto()) << ")" << std::endl;
+        return 0;
+    }
+    if (state->NextAction() == NextAction::PASS) {
+        std::cout << "Value: 0 (tie)\nBest moves: " << Move::Pass()
+                << " (" << compact << EncodeMove(Move::Pass()) << ")" << std::endl;
+        return 0;
+    }
+
+    const EnhancedState &est = state->Enhanced();
+    Solver solver(options);
+    auto start_time = std::chrono::steady_clock::now();
+    int value = solver.Solve(est, compact);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    std::cout << "Value: " << (value > 0 ? "+" : "") << value << " (" << DescribeValue(value) << ")\n";
+    std::cout << "Searched " << solver.Nodes() << " nodes in " << seconds << " s" << std::endl;
+
+    // List the moves that achieve the value. These can be appended to the
+    // compact state to continue the game from there.
+    std::vector<Move> best_moves;
+    for (Move move : state->ListValidMoves()) {
+        bool select = move.GetType() == Move::Type::SELECT;
+        if (!select && move.GetType() != Move::Type::PLACE) continue;
+        int index = select ? move.SelectedPiece() : move.PlacedField();
+        if (solver.SolveMove(est, index) == value) best_moves.push_back(move);
+    }
+    std::cout << "Best moves:";
+    for (Move move : best_moves) {
+        std::cout << ' ' << move << " (" << compact << EncodeMove(move) << ")";
+    }
+    std::cout << std::endl;
+}
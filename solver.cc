@@ -0,0 +1,359 @@
+#include "solver.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <thread>
+
+namespace {
+
+// Positions with fewer empty fields than this are not stored in the
+// transposition table, because they are cheaper to search than to look up.
+constexpr int min_table_empty_fields = 5;
+
+// Nodes searched by the current thread that haven't been added to the total.
+thread_local int64_t local_nodes = 0;
+
+int CountEmptyFields(const EnhancedState &est) {
+    return __builtin_popcount(est.pieces) + (est.next_piece >= 0);
+}
+
+bool HasWinningPlacement(const EnhancedState &est) {
+    for (int field = 0; field < 16; ++field) {
+        if (est.fields[field] < 0 && IsWinningPlacement(est, field)) return true;
+    }
+    return false;
+}
+
+}  // namespace
+
+TranspositionTable::TranspositionTable(int bits)
+        : size(size_t(1) << std::max(bits, 2)), entries(new Entry[size]) {}
+
+TranspositionTable::Bound TranspositionTable::Probe(const PositionKey &key, int &value) const {
+    assert(key.next_piece < 0);
+    size_t index = key.Hash() & (size - 1) & ~size_t(bucket_size - 1);
+    for (int i = 0; i < bucket_size; ++i) {
+        const Entry &entry = entries[index + i];
+        uint64_t data = entry.data.load(std::memory_order_relaxed);
+        uint64_t check = entry.check.load(std::memory_order_relaxed);
+        if (data == 0 || (data & 0xffff) != key.occupied || (check ^ data) != key.board) continue;
+        value = int((data >> 16) & 3) - 1;
+        return static_cast<Bound>((data >> 18) & 3);
+    }
+    return Bound::NONE;
+}
+
+void TranspositionTable::Store(const PositionKey &key, int empty_fields, Bound bound, int value) {
+    assert(key.next_piece < 0);
+    assert(bound != Bound::NONE);
+    assert(value >= -1 && value <= 1);
+    uint64_t data = key.occupied | uint64_t(value + 1) << 16 |
+            uint64_t(bound) << 18 | uint64_t(empty_fields) << 20;
+    size_t index = key.Hash() & (size - 1) & ~size_t(bucket_size - 1);
+    Entry *victim = nullptr;
+    int victim_empty_fields = 99;
+    for (int i = 0; i < bucket_size; ++i) {
+        Entry &entry = entries[index + i];
+        uint64_t old_data = entry.data.load(std::memory_order_relaxed);
+        uint64_t old_check = entry.check.load(std::memory_order_relaxed);
+        if (old_data == 0 || ((old_data & 0xffff) == key.occupied && (old_check ^ old_data) == key.board)) {
+            // Free slots and older results for the same position are always
+            // replaced; only other positions are preferred by depth.
+            victim = &entry;
+            victim_empty_fields = 99;
+            break;
+        }
+        int old_empty_fields = old_data >> 20;
+        if (old_empty_fields < victim_empty_fields) {
+            victim = &entry;
+            victim_empty_fields = old_empty_fields;
+        }
+    }
+    if (victim_empty_fields != 99 && victim_empty_fields > empty_fields) return;
+    victim->data.store(data, std::memory_order_relaxed);
+    victim->check.store(key.board ^ data, std::memory_order_relaxed);
+}
+
+Solver::Solver(const Options &options) : options(options), table(options.table_bits) {
+    this->options.threads = std::max(this->options.threads, 1);
+    this->options.split_depth = std::max(this->options.split_depth, 1);
+}
+
+int Solver::SearchSelect(const EnhancedState &est, int alpha, int beta, int placements_left) {
+    ++local_nodes;
+    if (est.pieces == 0) return 0;  // all pieces placed: tie
+    if (placements_left == 0) {
+        // Top of a task subtree: use the task result.
+        std::lock_guard<std::mutex> lock(results_mutex);
+        auto it = results.find(CanonicalKey(est));
+        if (it != results.end()) return it->second;
+    }
+    std::array<int, 16> moves;
+    int num_moves = ListNonlosingMoves(est, moves);
+    if (num_moves == 0) return -1;  // every piece lets the opponent win
+
+    const int empty_fields = CountEmptyFields(est);
+    const bool use_table = empty_fields >= min_table_empty_fields;
+    PositionKey key;
+    if (use_table) {
+        key = CanonicalKey(est);
+        int value = 0;
+        switch (table.Probe(key, value)) {
+        case TranspositionTable::Bound::EXACT:
+            return value;
+        case TranspositionTable::Bound::LOWER:
+            alpha = std::max(alpha, value);
+            break;
+        case TranspositionTable::Bound::UPPER:
+            beta = std::min(beta, value);
+            break;
+        case TranspositionTable::Bound::NONE:
+            break;
+        }
+        if (alpha >= beta) return value;
+    }
+
+    const int alpha_before = alpha;
+    int best = -1;
+    for (int i = 0; i < num_moves; ++i) {
+        EnhancedState child = est;
+        Select(child, moves[i]);
+        int value = -SearchPlace(child, -beta, -alpha, placements_left);
+        best = std::max(best, value);
+        alpha = std::max(alpha, value);
+        if (alpha >= beta) break;
+    }
+
+    if (use_table) {
+        TranspositionTable::Bound bound =
+                best <= alpha_before ? TranspositionTable::Bound::UPPER :
+                best >= beta ? TranspositionTable::Bound::LOWER :
+                TranspositionTable::Bound::EXACT;
+        table.Store(key, empty_fields, bound, best);
+    }
+    return best;
+}
+
+int Solver::SearchPlace(const EnhancedState &est, int alpha, int beta, int placements_left) {
+    int best = -2;
+    for (int field = 0; field < 16; ++field) {
+        if (est.fields[field] >= 0) continue;
+        EnhancedState child = est;
+        Place(child, field);
+        int value = SearchSelect(child, alpha, beta, placements_left > 0 ? placements_left - 1 : -1);
+        best = std::max(best, value);
+        alpha = std::max(alpha, value);
+        if (alpha >= beta) break;
+    }
+    assert(best >= -1);
+    return best;
+}
+
+void Solver::CollectTasks(const EnhancedState &est, int placements_left, std::vector<Task> &tasks,
+        std::unordered_map<PositionKey, int, PositionKeyHash> &seen) {
+    if (est.next_piece >= 0) {
+        for (int field = 0; field < 16; ++field) {
+            if (est.fields[field] >= 0) continue;
+            EnhancedState child = est;
+            Place(child, field);
+            CollectTasks(child, placements_left - 1, tasks, seen);
+        }
+        return;
+    }
+    if (est.pieces == 0) return;
+    std::array<int, 16> moves;
+    int num_moves = ListNonlosingMoves(est, moves);
+    if (num_moves == 0) return;
+    if (placements_left == 0) {
+        PositionKey key = CanonicalKey(est);
+        if (seen.emplace(key, 0).second) tasks.push_back(Task{est, key});
+        return;
+    }
+    for (int i = 0; i < num_moves; ++i) {
+        EnhancedState child = est;
+        Select(child, moves[i]);
+        CollectTasks(child, placements_left, tasks, seen);
+    }
+}
+
+void Solver::RunWorker(int thread_index) {
+    const int num_queues = queues.size();
+    for (;;) {
+        std::optional<Task> task;
+        {
+            // Take the most recently added task from our own queue.
+            Queue &queue = *queues[thread_index];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (!queue.tasks.empty()) {
+                task = queue.tasks.back();
+                queue.tasks.pop_back();
+            }
+        }
+        for (int i = 1; !task && i < num_queues; ++i) {
+            // Steal the oldest task from another queue.
+            Queue &queue = *queues[(thread_index + i) % num_queues];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (!queue.tasks.empty()) {
+                task = queue.tasks.front();
+                queue.tasks.pop_front();
+            }
+        }
+        if (!task) break;
+        int value = SearchSelect(task->est, -1, 1, -1);
+        {
+            std::lock_guard<std::mutex> lock(results_mutex);
+            results[task->key] = value;
+            ++tasks_finished;
+        }
+        task_finished.notify_one();
+        nodes += local_nodes;
+        local_nodes = 0;
+    }
+}
+
+bool Solver::LoadCheckpoint(const std::string &position) {
+    std::ifstream ifs(options.checkpoint_path);
+    if (!ifs) return false;
+    std::string magic, label, saved_position;
+    int version = 0, split_depth = 0;
+    if (!(ifs >> magic >> version) || magic != "quarto-solver-checkpoint" || version != 1) {
+        std::cerr << "Ignoring invalid checkpoint " << options.checkpoint_path << std::endl;
+        return false;
+    }
+    std::string line;
+    std::getline(ifs, line);
+    std::getline(ifs, line);
+    std::istringstream(line) >> label >> saved_position;
+    if (label != "position" || saved_position != (position.empty() ? "-" : position)) {
+        std::cerr << "Ignoring checkpoint for a different position" << std::endl;
+        return false;
+    }
+    if (!(ifs >> label >> split_depth) || label != "split-depth" ||
+            split_depth != options.split_depth) {
+        std::cerr << "Ignoring checkpoint with a different split depth" << std::endl;
+        return false;
+    }
+    PositionKey key;
+    int value;
+    while (ifs >> std::hex >> key.board >> key.occupied >> std::dec >> value) {
+        results[key] = value;
+    }
+    return true;
+}
+
+void Solver::SaveCheckpoint(const std::string &position) {
+    std::string temp_path = options.checkpoint_path + ".tmp";
+    {
+        std::ofstream ofs(temp_path);
+        ofs << "quarto-solver-checkpoint 1\n";
+        ofs << "position " << (position.empty() ? "-" : position) << '\n';
+        ofs << "split-depth " << options.split_depth << '\n';
+        std::lock_guard<std::mutex> lock(results_mutex);
+        for (const auto &[key, value] : results) {
+            ofs << std::hex << key.board << ' ' << key.occupied << ' ' << std::dec << value << '\n';
+        }
+        if (!ofs) {
+            std::cerr << "Failed to write checkpoint " << temp_path << std::endl;
+            return;
+        }
+    }
+    // Replace the old checkpoint atomically, so a crash can't corrupt it.
+    if (rename(temp_path.c_str(), options.checkpoint_path.c_str()) != 0) {
+        perror("rename");
+    }
+}
+
+int Solver::Solve(const EnhancedState &est, const std::string &position) {
+    if (est.next_piece >= 0 && HasWinningPlacement(est)) return 1;
+
+    std::vector<Task> tasks;
+    {
+        std::unordered_map<PositionKey, int, PositionKeyHash> seen;
+        CollectTasks(est, options.split_depth, tasks, seen);
+    }
+    const int total_tasks = tasks.size();
+    if (!options.checkpoint_path.empty() && LoadCheckpoint(position)) {
+        tasks.erase(std::remove_if(tasks.begin(), tasks.end(),
+                [this](const Task &task) { return results.count(task.key) > 0; }), tasks.end());
+        if (options.verbose) {
+            std::cerr << "Resuming from checkpoint: " << total_tasks - tasks.size()
+                    << " of " << total_tasks << " tasks done." << std::endl;
+        }
+    }
+    // Deal out tasks round-robin. Threads take tasks from the back of their
+    // own queue, so reverse the queues to process tasks in order.
+    queues.clear();
+    for (int i = 0; i < options.threads; ++i) queues.push_back(std::make_unique<Queue>());
+    for (size_t i = 0; i < tasks.size(); ++i) {
+        queues[i % options.threads]->tasks.push_back(tasks[i]);
+    }
+    for (auto &queue : queues) std::reverse(queue->tasks.begin(), queue->tasks.end());
+
+    const int remaining_tasks = tasks.size();
+    tasks_finished = 0;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < options.threads; ++i) {
+        threads.emplace_back(&Solver::RunWorker, this, i);
+    }
+    using clock = std::chrono::steady_clock;
+    const auto start_time = clock::now();
+    auto last_checkpoint = start_time;
+    auto last_report = start_time;
+    for (;;) {
+        {
+            // Wake up now and then for checkpoints and progress reports.
+            std::unique_lock<std::mutex> lock(results_mutex);
+            if (task_finished.wait_for(lock, std::chrono::milliseconds(100),
+                    [this, remaining_tasks]{ return tasks_finished >= remaining_tasks; })) {
+                break;
+            }
+        }
+        auto now = clock::now();
+        if (!options.checkpoint_path.empty() &&
+                now - last_checkpoint >= std::chrono::seconds(options.checkpoint_interval_seconds)) {
+            SaveCheckpoint(position);
+            last_checkpoint = now;
+        }
+        if (options.verbose && now - last_report >= std::chrono::seconds(10)) {
+            double seconds = std::chrono::duration<double>(now - start_time).count();
+            std::cerr << "Solved " << tasks_finished << " of " << remaining_tasks << " tasks; "
+                    << nodes << " nodes in " << seconds << " s ("
+                    << int64_t(nodes / seconds) << " nodes/s)" << std::endl;
+            last_report = now;
+        }
+    }
+    for (std::thread &thread : threads) thread.join();
+    if (!options.checkpoint_path.empty() && remaining_tasks > 0) {
+        SaveCheckpoint(position);
+    }
+
+    // Combine task results at the top of the tree.
+    int value = est.next_piece < 0 ?
+            SearchSelect(est, -1, 1, options.split_depth) :
+            SearchPlace(est, -1, 1, options.split_depth);
+    nodes += local_nodes;
+    local_nodes = 0;
+    return value;
+}
+
+int Solver::SolveMove(const EnhancedState &est, int move) {
+    EnhancedState child = est;
+    int value;
+    if (est.next_piece < 0) {
+        Select(child, move);
+        value = HasWinningPlacement(child) ? -1 : -SearchPlace(child, -1, 1, options.split_depth);
+    } else {
+        if (IsWinningPlacement(est, move)) return 1;
+        Place(child, move);
+        value = SearchSelect(child, -1, 1, options.split_depth - 1);
+    }
+    nodes += local_nodes;
+    local_nodes = 0;
+    return value;
+}
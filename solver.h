@@ -0,0 +1,122 @@
+#ifndef SOLVER_H_INCLUDED
+#define SOLVER_H_INCLUDED
+
+#include "enhanced_state.h"
+#include "symmetry.h"
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Shared transposition table for the solver, which stores bounds on the
+// values of positions where a piece must be selected.
+//
+// Entries are written without locking. Each entry consists of two words, the
+// first of which is XOR-ed with the second, so that entries that are torn by
+// concurrent writes are detected as mismatches (and ignored) when read.
+class TranspositionTable {
+public:
+    enum class Bound : unsigned char { NONE = 0, EXACT = 1, LOWER = 2, UPPER = 3 };
+
+    // Creates a table with 2^bits entries.
+    explicit TranspositionTable(int bits);
+
+    // Looks up the position. Returns Bound::NONE if it's not found.
+    Bound Probe(const PositionKey &key, int &value) const;
+
+    // Stores a bound on the value of the position, which has `empty_fields`
+    // empty fields. Entries for positions with more empty fields (which are
+    // presumably more expensive to recompute) are preferred when replacing.
+    void Store(const PositionKey &key, int empty_fields, Bound bound, int value);
+
+    size_t Size() const { return size; }
+
+private:
+    static constexpr int bucket_size = 4;
+
+    struct Entry {
+        std::atomic<uint64_t> check{0};  // board ^ data
+        std::atomic<uint64_t> data{0};   // occupied | value | bound | empty fields
+    };
+
+    size_t size;
+    std::unique_ptr<Entry[]> entries;
+};
+
+// Computes game-theoretic values of positions with a parallel alpha-beta
+// search.
+//
+// Values are from the perspective of the player to move: +1 for a win, 0 for
+// a tie and -1 for a loss, assuming both players play perfectly.
+//
+// The top of the game tree (up to `split_depth` placements from the root) is
+// expanded into independent tasks, which are divided over the worker threads.
+// Idle threads steal tasks from the others. The values of finished tasks can
+// be written to a checkpoint file periodically, so that an interrupted run can
+// continue where it left off.
+class Solver {
+public:
+    struct Options {
+        int threads = 1;
+        int table_bits = 24;
+        int split_depth = 2;
+        std::string checkpoint_path;
+        int checkpoint_interval_seconds = 600;
+        bool verbose = false;
+    };
+
+    explicit Solver(const Options &options);
+
+    // Solves the position, which may require a piece to be selected or placed.
+    // `position` identifies the position in checkpoints (e.g. a compact move
+    // string); a checkpoint for a different position is ignored.
+    int Solve(const EnhancedState &est, const std::string &position = "");
+
+    // Returns the value of the given move from the root, from the perspective
+    // of the player making the move. Uses the results of a previous Solve()
+    // call where possible.
+    int SolveMove(const EnhancedState &est, int move);
+
+    // Number of positions searched so far.
+    int64_t Nodes() const { return nodes; }
+
+private:
+    struct Task {
+        EnhancedState est;
+        PositionKey key;
+    };
+
+    int SearchSelect(const EnhancedState &est, int alpha, int beta, int placements_left);
+    int SearchPlace(const EnhancedState &est, int alpha, int beta, int placements_left);
+    void CollectTasks(const EnhancedState &est, int placements_left, std::vector<Task> &tasks,
+            std::unordered_map<PositionKey, int, PositionKeyHash> &seen);
+    void RunWorker(int thread_index);
+    bool LoadCheckpoint(const std::string &position);
+    void SaveCheckpoint(const std::string &position);
+
+    Options options;
+    TranspositionTable table;
+    std::atomic<int64_t> nodes{0};
+
+    // Work queues, one per thread.
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+    std::vector<std::unique_ptr<Queue>> queues;
+
+    // Values of finished tasks, indexed by canonical key.
+    std::mutex results_mutex;
+    std::unordered_map<PositionKey, int, PositionKeyHash> results;
+    std::atomic<int> tasks_finished{0};  // only increased with results_mutex held
+    std::condition_variable task_finished;
+};
+
+#endif /* ndef SOLVER_H_INCLUDED */
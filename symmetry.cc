@@ -0,0 +1,149 @@
+#include "symmetry.h"
+
+#include <assert.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace {
+
+using Permutation = std::array<signed char, 16>;
+
+// Builds a field permutation from a function that maps (row, column) pairs.
+template<class F>
+Permutation MakePermutation(F f) {
+    Permutation p;
+    for (int r = 0; r < 4; ++r) {
+        for (int c = 0; c < 4; ++c) {
+            auto [r2, c2] = f(r, c);
+            p[4*r + c] = 4*r2 + c2;
+        }
+    }
+    return p;
+}
+
+bool PreservesLines(const Permutation &p) {
+    for (int field = 0; field < 16; ++field) {
+        for (int other = 0; other < 16; ++other) {
+            // Two fields share a line iff their images do.
+            auto shares_line = [](int a, int b) {
+                for (const signed char *x = lines_per_field[a]; *x >= 0; ++x) {
+                    for (const signed char *y = lines_per_field[b]; *y >= 0; ++y) {
+                        if (*x == *y) return true;
+                    }
+                }
+                return false;
+            };
+            if (shares_line(field, other) != shares_line(p[field], p[other])) return false;
+        }
+    }
+    return true;
+}
+
+std::array<Permutation, 32> GenerateBoardSymmetries() {
+    const Permutation generators[] = {
+        // Transpose.
+        MakePermutation([](int r, int c) { return std::pair(c, r); }),
+        // Mirror vertically.
+        MakePermutation([](int r, int c) { return std::pair(3 - r, c); }),
+        // Swap inner and outer rows and columns: 0123 -> 1032.
+        MakePermutation([](int r, int c) { return std::pair(r ^ 1, c ^ 1); }),
+        // Swap middle rows and columns: 0123 -> 0213.
+        MakePermutation([](int r, int c) {
+            auto swap_middle = [](int i) { return i == 1 ? 2 : i == 2 ? 1 : i; };
+            return std::pair(swap_middle(r), swap_middle(c));
+        }),
+    };
+    Permutation identity;
+    for (int i = 0; i < 16; ++i) identity[i] = i;
+    std::vector<Permutation> group = {identity};
+    for (size_t i = 0; i < group.size(); ++i) {
+        for (const Permutation &g : generators) {
+            Permutation p;
+            for (int f = 0; f < 16; ++f) p[f] = g[group[i][f]];
+            if (std::find(group.begin(), group.end(), p) == group.end()) {
+                group.push_back(p);
+            }
+        }
+    }
+    assert(group.size() == 32);
+    std::array<Permutation, 32> result;
+    for (int i = 0; i < 32; ++i) {
+        assert(PreservesLines(group[i]));
+        result[i] = group[i];
+    }
+    return result;
+}
+
+// For each symmetry, the field that is mapped to field i.
+const std::array<Permutation, 32> &InverseBoardSymmetries() {
+    static const std::array<Permutation, 32> inverses = []{
+        std::array<Permutation, 32> result;
+        for (int i = 0; i < 32; ++i) {
+            for (int f = 0; f < 16; ++f) result[i][BoardSymmetries()[i][f]] = f;
+        }
+        return result;
+    }();
+    return inverses;
+}
+
+}  // namespace
+
+int Symmetry::UnmapField(int field) const {
+    return std::find(fields.begin(), fields.end(), field) - fields.begin();
+}
+
+const std::array<std::array<signed char, 16>, 32> &BoardSymmetries() {
+    static const std::array<Permutation, 32> symmetries = GenerateBoardSymmetries();
+    return symmetries;
+}
+
+PositionKey MakeKey(const EnhancedState &est) {
+    PositionKey key;
+    key.next_piece = est.next_piece;
+    for (int field = 0; field < 16; ++field) {
+        if (est.fields[field] >= 0) {
+            key.board |= uint64_t(est.fields[field]) << (4*field);
+            key.occupied |= 1 << field;
+        }
+    }
+    return key;
+}
+
+PositionKey CanonicalKey(const EnhancedState &est, Symmetry *symmetry) {
+    const std::array<Permutation, 32> &inverses = InverseBoardSymmetries();
+    PositionKey best;
+    int best_index = -1;
+    int best_mask = 0;
+    for (int i = 0; i < 32; ++i) {
+        const Permutation &source = inverses[i];
+        // Flip attributes so that the piece on the first occupied field (or
+        // else the next piece) becomes piece 0.
+        int mask = est.next_piece >= 0 ? est.next_piece : 0;
+        for (int field = 0; field < 16; ++field) {
+            if (est.fields[source[field]] >= 0) {
+                mask = est.fields[source[field]];
+                break;
+            }
+        }
+        PositionKey key;
+        key.next_piece = est.next_piece < 0 ? -1 : est.next_piece ^ mask;
+        for (int field = 0; field < 16; ++field) {
+            int piece = est.fields[source[field]];
+            if (piece >= 0) {
+                key.board |= uint64_t(piece ^ mask) << (4*field);
+                key.occupied |= 1 << field;
+            }
+        }
+        if (best_index < 0 || key < best) {
+            best = key;
+            best_index = i;
+            best_mask = mask;
+        }
+    }
+    if (symmetry) {
+        symmetry->fields = BoardSymmetries()[best_index];
+        symmetry->pieces = best_mask;
+    }
+    return best;
+}
@@ -0,0 +1,76 @@
+#ifndef SYMMETRY_H_INCLUDED
+#define SYMMETRY_H_INCLUDED
+
+#include "enhanced_state.h"
+
+#include <stdint.h>
+
+#include <array>
+#include <functional>
+
+// Compact, hashable representation of an EnhancedState.
+struct PositionKey {
+    // Piece numbers of occupied fields, 4 bits per field (0 if empty).
+    uint64_t board = 0;
+
+    // Bitmask of occupied fields.
+    uint16_t occupied = 0;
+
+    // Piece to place next, or -1 if a piece must be selected.
+    int8_t next_piece = -1;
+
+    bool operator==(const PositionKey &k) const {
+        return board == k.board && occupied == k.occupied && next_piece == k.next_piece;
+    }
+    bool operator!=(const PositionKey &k) const { return !(*this == k); }
+    bool operator<(const PositionKey &k) const {
+        if (occupied != k.occupied) return occupied < k.occupied;
+        if (board != k.board) return board < k.board;
+        return next_piece < k.next_piece;
+    }
+
+    uint64_t Hash() const {
+        // splitmix64 finalizer over the combined fields.
+        uint64_t x = board ^ ((uint64_t(occupied) << 8 | uint8_t(next_piece)) * 0x9e3779b97f4a7c15ULL);
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+};
+
+struct PositionKeyHash {
+    size_t operator()(const PositionKey &k) const { return k.Hash(); }
+};
+
+// A symmetry of the game maps field f to fields[f], and piece p to p ^ pieces.
+//
+// The board has 32 symmetries that map lines onto lines (the 8 rotations and
+// reflections of the square, combined with swapping the inner and outer rows
+// and columns, and swapping the middle rows and columns). Flipping any
+// attribute of all pieces preserves which lines have common attributes, too.
+struct Symmetry {
+    std::array<signed char, 16> fields;
+    int pieces;
+
+    int MapField(int field) const { return fields[field]; }
+    int MapPiece(int piece) const { return piece < 0 ? piece : piece ^ pieces; }
+    int UnmapField(int field) const;
+    int UnmapPiece(int piece) const { return MapPiece(piece); }
+};
+
+// Returns the 32 field permutations that preserve lines on the board. The
+// first one is the identity.
+const std::array<std::array<signed char, 16>, 32> &BoardSymmetries();
+
+// Returns the key of the position without applying any symmetry.
+PositionKey MakeKey(const EnhancedState &est);
+
+// Returns the same key for all positions that are equivalent under the board
+// symmetries and flipping of piece attributes. If `symmetry` is not null, it
+// receives the symmetry that maps `est` onto the canonical position.
+//
+// (Permutations of the attributes are not considered, which makes this
+// reduction incomplete, but much cheaper to compute.)
+PositionKey CanonicalKey(const EnhancedState &est, Symmetry *symmetry = nullptr);
+
+#endif /* ndef SYMMETRY_H_INCLUDED */
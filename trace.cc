@@ -0,0 +1,235 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace tracing {
+
+namespace {
+
+constexpr size_t ring_size = 1 << 20;  // events per thread
+
+// Events are stored as two words, so that they can be read while the owning
+// thread overwrites them (the reader discards what it can't trust).
+struct Slot {
+    std::atomic<uint64_t> start;
+    std::atomic<uint64_t> duration_and_phase;  // duration << 8 | phase
+};
+
+// Single-producer ring buffer of a thread's events.
+class Ring {
+public:
+    explicit Ring(int tid) : tid(tid), slots(new Slot[ring_size]) {}
+
+    // Only called by the owning thread.
+    void Add(Phase phase, uint64_t start, uint64_t end) {
+        const uint64_t h = head.load(std::memory_order_relaxed);
+        // Readers check `started` to see if a slot was overwritten.
+        started.store(h + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        Slot &slot = slots[h & (ring_size - 1)];
+        slot.start.store(start, std::memory_order_relaxed);
+        slot.duration_and_phase.store((end - start) << 8 | static_cast<uint64_t>(phase),
+                std::memory_order_relaxed);
+        head.store(h + 1, std::memory_order_release);
+        const int p = static_cast<int>(phase);
+        counts[p].store(counts[p].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        nanos[p].store(nanos[p].load(std::memory_order_relaxed) + (end - start), std::memory_order_relaxed);
+    }
+
+    // Calls f(phase, start, duration) for each event that is still in the
+    // ring, oldest first.
+    template<class F>
+    void ForEach(F f) const {
+        const uint64_t end = head.load(std::memory_order_acquire);
+        const uint64_t begin = end > ring_size ? end - ring_size : 0;
+        struct Event { uint64_t start, duration_and_phase; };
+        std::vector<Event> events;
+        events.reserve(end - begin);
+        for (uint64_t i = begin; i < end; ++i) {
+            const Slot &slot = slots[i & (ring_size - 1)];
+            events.push_back(Event{slot.start.load(std::memory_order_relaxed),
+                    slot.duration_and_phase.load(std::memory_order_relaxed)});
+        }
+        // Skip the events that may have been overwritten while copying.
+        std::atomic_thread_fence(std::memory_order_acquire);
+        const uint64_t overwriting = started.load(std::memory_order_relaxed);
+        const uint64_t valid_begin = overwriting > ring_size ? overwriting - ring_size : 0;
+        for (uint64_t i = std::max(begin, valid_begin); i < end; ++i) {
+            const Event &e = events[i - begin];
+            f(static_cast<Phase>(e.duration_and_phase & 0xff), e.start, e.duration_and_phase >> 8);
+        }
+    }
+
+    void Clear() {
+        head.store(0, std::memory_order_relaxed);
+        started.store(0, std::memory_order_relaxed);
+        for (int p = 0; p < num_phases; ++p) {
+            counts[p].store(0, std::memory_order_relaxed);
+            nanos[p].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    const int tid;
+    std::array<std::atomic<uint64_t>, num_phases> counts = {};
+    std::array<std::atomic<uint64_t>, num_phases> nanos = {};
+
+private:
+    std::unique_ptr<Slot[]> slots;
+    std::atomic<uint64_t> head{0};     // number of events written
+    std::atomic<uint64_t> started{0};  // number of events started
+};
+
+struct MarkEvent {
+    uint64_t time;
+    int tid;
+    std::string label;
+};
+
+// All rings ever created. Rings of threads that have exited are kept, so that
+// their events can still be written.
+struct Registry {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Ring>> rings;
+    std::vector<MarkEvent> marks;
+};
+
+Registry &GetRegistry() {
+    static Registry registry;
+    return registry;
+}
+
+Ring &ThreadRing() {
+    thread_local Ring *ring = nullptr;
+    if (!ring) {
+        Registry &registry = GetRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.rings.push_back(std::make_unique<Ring>(registry.rings.size()));
+        ring = registry.rings.back().get();
+    }
+    return *ring;
+}
+
+void WriteJsonString(std::ostream &os, const std::string &s) {
+    os << '"';
+    for (char ch : s) {
+        if (ch == '"' || ch == '\\') os << '\\' << ch;
+        else if (static_cast<unsigned char>(ch) < 0x20) os << ' ';
+        else os << ch;
+    }
+    os << '"';
+}
+
+}  // namespace
+
+const char *PhaseName(Phase phase) {
+    switch (phase) {
+    case Phase::ITERATION: return "iteration";
+    case Phase::SELECTION: return "selection";
+    case Phase::EXPANSION: return "expansion";
+    case Phase::PLAYOUT: return "playout";
+    case Phase::SOLVER: return "solver";
+    case Phase::PROOF: return "proof";
+    case Phase::BACKUP: return "backup";
+    }
+    return "unknown";
+}
+
+bool Available() {
+#ifdef QUARTO_TRACING
+    return true;
+#else
+    return false;
+#endif
+}
+
+void Enable(bool enabled) {
+    EnabledFlag().store(enabled && Available(), std::memory_order_relaxed);
+}
+
+uint64_t NowNanos() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Record(Phase phase, uint64_t start, uint64_t end) {
+    ThreadRing().Add(phase, start, end);
+}
+
+void Mark(const std::string &label) {
+    if (!Enabled()) return;
+    int tid = ThreadRing().tid;
+    Registry &registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.marks.push_back(MarkEvent{NowNanos(), tid, label});
+}
+
+void Clear() {
+    Registry &registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    for (const std::unique_ptr<Ring> &ring : registry.rings) ring->Clear();
+    registry.marks.clear();
+}
+
+bool WriteChromeTrace(const std::string &path) {
+    std::ofstream os(path);
+    if (!os) {
+        std::cerr << "Could not open " << path << std::endl;
+        return false;
+    }
+    Registry &registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    // Timestamps are in microseconds, relative to the first event.
+    uint64_t origin = UINT64_MAX;
+    for (const std::unique_ptr<Ring> &ring : registry.rings) {
+        ring->ForEach([&origin](Phase, uint64_t start, uint64_t) { origin = std::min(origin, start); });
+    }
+    for (const MarkEvent &mark : registry.marks) origin = std::min(origin, mark.time);
+
+    os << std::fixed << std::setprecision(3) << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    const char *separator = "\n";
+    for (const std::unique_ptr<Ring> &ring : registry.rings) {
+        ring->ForEach([&](Phase phase, uint64_t start, uint64_t duration) {
+            os << separator << "{\"name\":\"" << PhaseName(phase) << "\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+                    << ring->tid << ",\"ts\":" << (start - origin)/1e3 << ",\"dur\":" << duration/1e3 << '}';
+            separator = ",\n";
+        });
+    }
+    for (const MarkEvent &mark : registry.marks) {
+        os << separator << "{\"name\":";
+        WriteJsonString(os, mark.label);
+        os << ",\"ph\":\"i\",\"s\":\"p\",\"pid\":1,\"tid\":" << mark.tid << ",\"ts\":"
+                << (mark.time - origin)/1e3 << '}';
+        separator = ",\n";
+    }
+    os << "\n]}\n";
+    return bool(os);
+}
+
+void WriteSummary(std::ostream &os) {
+    std::array<uint64_t, num_phases> counts = {}, nanos = {};
+    {
+        Registry &registry = GetRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        for (const std::unique_ptr<Ring> &ring : registry.rings) {
+            for (int p = 0; p < num_phases; ++p) {
+                counts[p] += ring->counts[p].load(std::memory_order_relaxed);
+                nanos[p] += ring->nanos[p].load(std::memory_order_relaxed);
+            }
+        }
+    }
+    for (int p = 0; p < num_phases; ++p) {
+        os << std::left << std::setw(10) << PhaseName(static_cast<Phase>(p)) << std::right
+                << std::setw(12) << counts[p] << " events " << std::fixed << std::setprecision(3)
+                << std::setw(10) << nanos[p]/1e9 << " s\n";
+    }
+}
+
+}  // namespace tracing
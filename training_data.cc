@@ -0,0 +1,126 @@
+#include "training_data.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <iostream>
+
+const TrainingDataHeader training_data_header = {
+    {'Q', 'R', 'T', 'O', 'T', 'R', 'N', '1'}, sizeof(TrainingRecord), 0};
+
+TrainingDataWriter::TrainingDataWriter(const std::string &path) {
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+        perror(path.c_str());
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        perror(path.c_str());
+        close(fd);
+        return;
+    }
+    if (st.st_size > 0) {
+        TrainingDataHeader header;
+        if (st.st_size < (off_t) sizeof(header) ||
+                pread(fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header) ||
+                memcmp(header.magic, training_data_header.magic, sizeof(header.magic)) != 0 ||
+                header.record_size != sizeof(TrainingRecord)) {
+            std::cerr << path << ": not a training data file of this format" << std::endl;
+            close(fd);
+            return;
+        }
+        // Records appended after a partial one would all be misaligned.
+        const off_t records_end = st.st_size -
+                (st.st_size - sizeof(TrainingDataHeader)) % sizeof(TrainingRecord);
+        if (records_end != st.st_size) {
+            std::cerr << path << ": removing a partial record at the end" << std::endl;
+            if (ftruncate(fd, records_end) != 0) {
+                perror(path.c_str());
+                close(fd);
+                return;
+            }
+        }
+    }
+    file = fdopen(fd, "ab");
+    if (!file) {
+        perror(path.c_str());
+        close(fd);
+        return;
+    }
+    // Use a large buffer, since records are written in big blocks anyway.
+    setvbuf(file, nullptr, _IOFBF, 1 << 20);
+    if (st.st_size == 0 && fwrite(&training_data_header, sizeof(training_data_header), 1, file) != 1) {
+        perror(path.c_str());
+        fclose(file);
+        file = nullptr;
+    }
+}
+
+TrainingDataWriter::~TrainingDataWriter() {
+    Close();
+}
+
+bool TrainingDataWriter::Close() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!file) return true;
+    // Errors writing the buffer only show up here.
+    bool ok = fflush(file) == 0;
+    if (!ok) perror("fflush");
+    if (fclose(file) != 0 && ok) {
+        perror("fclose");
+        ok = false;
+    }
+    file = nullptr;
+    return ok;
+}
+
+bool TrainingDataWriter::Write(const std::vector<TrainingRecord> &records) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!file) return false;
+    if (fwrite(records.data(), sizeof(TrainingRecord), records.size(), file) != records.size()) {
+        perror("fwrite");
+        return false;
+    }
+    records_written += records.size();
+    return true;
+}
+
+MappedTrainingData::MappedTrainingData(const std::string &path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        perror(path.c_str());
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(TrainingDataHeader)) {
+        std::cerr << path << ": not a training data file" << std::endl;
+        close(fd);
+        return;
+    }
+    length = st.st_size;
+    void *p = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        return;
+    }
+    const TrainingDataHeader *header = static_cast<const TrainingDataHeader*>(p);
+    if (memcmp(header->magic, training_data_header.magic, sizeof(header->magic)) != 0 ||
+            header->record_size != sizeof(TrainingRecord)) {
+        std::cerr << path << ": unsupported training data format" << std::endl;
+        munmap(p, length);
+        return;
+    }
+    data = p;
+    records = reinterpret_cast<const TrainingRecord*>(static_cast<const char*>(p) + sizeof(TrainingDataHeader));
+    // Ignore a partially written record at the end.
+    num_records = (length - sizeof(TrainingDataHeader)) / sizeof(TrainingRecord);
+}
+
+MappedTrainingData::~MappedTrainingData() {
+    if (data) munmap(data, length);
+}
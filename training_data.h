@@ -0,0 +1,112 @@
+#ifndef TRAINING_DATA_H_INCLUDED
+#define TRAINING_DATA_H_INCLUDED
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Binary format for self-play training data.
+//
+// A file consists of a 16-byte header followed by fixed-size records, stored
+// in little-endian byte order. Files are append-only: records from later runs
+// are simply added at the end. Since all records have the same size and
+// alignment, a memory-mapped file can be read as an array of records without
+// any decoding.
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__,
+        "training data is stored in native little-endian byte order");
+
+struct TrainingDataHeader {
+    char magic[8];         // "QRTOTRN1"
+    uint32_t record_size;  // sizeof(TrainingRecord)
+    uint32_t reserved;
+};
+
+static_assert(sizeof(TrainingDataHeader) == 16);
+
+// One position from a self-play game.
+struct TrainingRecord {
+    // Piece numbers of occupied fields, 4 bits per field (0 if empty).
+    uint64_t board;
+
+    // Bitmask of occupied fields.
+    uint16_t occupied;
+
+    // Piece to place, or -1 if a piece must be selected.
+    int8_t next_piece;
+
+    // Final result of the game for the player to move: -1, 0 or +1.
+    int8_t result;
+
+    // Number of moves played before this position (0 through 31).
+    uint8_t move_number;
+
+    // Move that was played: a piece number or a field number.
+    uint8_t move_played;
+
+    uint16_t reserved;
+
+    // Visit counts of the root's children after the search, indexed by piece
+    // number (if a piece must be selected) or field number. Moves that were
+    // pruned (because they lose immediately) have zero visits.
+    uint32_t visits[16];
+};
+
+static_assert(sizeof(TrainingRecord) == 80);
+
+extern const TrainingDataHeader training_data_header;
+
+// Appends records to a training data file. Safe to use from multiple threads.
+class TrainingDataWriter {
+public:
+    // Opens the file for appending, writing the header if the file is new.
+    // An existing file must have a matching header; a partial record at its
+    // end (e.g. after a crash) is cut off. Check Ok() afterwards.
+    explicit TrainingDataWriter(const std::string &path);
+    ~TrainingDataWriter();
+
+    bool Ok() const { return file != nullptr; }
+
+    // Writes out buffered records and closes the file. Returns false (after
+    // printing a message) if anything couldn't be written.
+    bool Close();
+
+    // Appends the records as one contiguous block.
+    bool Write(const std::vector<TrainingRecord> &records);
+
+    // Total number of records written so far.
+    uint64_t RecordsWritten() const { return records_written; }
+
+private:
+    std::mutex mutex;
+    FILE *file = nullptr;
+    uint64_t records_written = 0;
+};
+
+// Read-only, memory-mapped view of a training data file.
+class MappedTrainingData {
+public:
+    // Maps the file. Check Ok() afterwards.
+    explicit MappedTrainingData(const std::string &path);
+    ~MappedTrainingData();
+
+    MappedTrainingData(const MappedTrainingData&) = delete;
+    MappedTrainingData &operator=(const MappedTrainingData&) = delete;
+
+    bool Ok() const { return data != nullptr; }
+    size_t size() const { return num_records; }
+    const TrainingRecord *begin() const { return records; }
+    const TrainingRecord *end() const { return records + num_records; }
+    const TrainingRecord &operator[](size_t i) const { return records[i]; }
+
+private:
+    void *data = nullptr;
+    size_t length = 0;
+    const TrainingRecord *records = nullptr;
+    size_t num_records = 0;
+};
+
+#endif /* ndef TRAINING_DATA_H_INCLUDED */
@@ -0,0 +1,234 @@
+// Tunes search parameters for playing strength at a fixed time per move, with
+// simultaneous perturbation stochastic approximation (SPSA).
+//
+// Usage: quarto-tune [<options>]
+//
+// Each step perturbs all tuned parameters at once in random directions, plays
+// games between the two perturbed configurations, and moves the parameters
+// towards the configuration that scored better. Games are played in parallel,
+// in pairs with the same seed and swapped colors.
+//
+// The result is printed as a list of name=value pairs, which quarto accepts as
+// --mcts-config. Since the strength at a fixed time depends on the speed of
+// the machine, tune on the kind of hardware the engine will run on.
+
+#include "quarto.h"
+#include "ai_mcts.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// A tuned parameter, with the range it's kept in and the size of the
+// perturbations (which shrinks slowly over time).
+struct Parameter {
+    std::string name;
+    double min, max;
+    double perturbation;
+    bool integer;
+    double (*get)(const AiMctsConfig &config);
+};
+
+const std::vector<Parameter> tunable_parameters = {
+    {"exploration_factor", 0.05, 8, 0.4, false,
+        [](const AiMctsConfig &c) -> double { return c.exploration_factor; }},
+    {"evaluation_weight", 0, 1, 0.1, false,
+        [](const AiMctsConfig &c) -> double { return c.evaluation_weight; }},
+    {"playout_cutoff_depth", 0, 16, 2, true,
+        [](const AiMctsConfig &c) -> double { return c.playout_cutoff_depth; }},
+    {"rave_equivalence", 0, 2000, 50, false,
+        [](const AiMctsConfig &c) -> double { return c.rave_equivalence; }},
+    {"pns_visits", 0, 100000, 200, true,
+        [](const AiMctsConfig &c) -> double { return c.pns_visits; }},
+};
+
+struct Options {
+    int steps = 100;
+    int game_pairs = 8;  // per step
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    std::chrono::milliseconds move_time{50};
+    double learning_rate = 1;
+    std::vector<std::string> params = {"exploration_factor", "evaluation_weight", "playout_cutoff_depth"};
+    AiMctsConfig config;
+    unsigned seed = std::random_device()();
+};
+
+std::string FormatValue(const Parameter &p, double value) {
+    std::ostringstream oss;
+    if (p.integer) oss << lround(value); else oss << value;
+    return oss.str();
+}
+
+std::string FormatConfig(const std::vector<Parameter> &params, const std::vector<double> &values) {
+    std::string result;
+    for (size_t i = 0; i < params.size(); ++i) {
+        if (i > 0) result += ',';
+        result += params[i].name + '=' + FormatValue(params[i], values[i]);
+    }
+    return result;
+}
+
+AiMctsConfig MakeConfig(const Options &options, const std::vector<Parameter> &params,
+        const std::vector<double> &values) {
+    AiMctsConfig config = options.config;
+    for (size_t i = 0; i < params.size(); ++i) {
+        SetAiMctsParameter(config, params[i].name, FormatValue(params[i], values[i]));
+    }
+    return config;
+}
+
+// Plays a game, and returns the result for the first player: +1, 0 or -1.
+int PlayGame(const AiMctsConfig &first, const AiMctsConfig &second, unsigned seed,
+        std::chrono::milliseconds move_time) {
+    State state = State::Initial();
+    AiMcts ai0(state, seed, first), ai1(state, seed ^ 0x5bd1e995, second);
+    ai0.SetVerbose(false);
+    ai1.SetVerbose(false);
+    while (!state.Over()) {
+        AiMcts &ai = state.NextPlayer() == 0 ? ai0 : ai1;
+        std::shared_ptr<SearchHandle> search = ai.PrepareSearch(SearchBudget{0, move_time});
+        while (search->RunSlice(100)) {}
+        Move move = search->Wait();
+        state.ExecuteValid(move);
+        ai0.Execute(move);
+        ai1.Execute(move);
+    }
+    int winner = state.Winner();
+    return winner < 0 ? 0 : winner == 0 ? 1 : -1;
+}
+
+// Plays pairs of games between the two configurations in parallel, and
+// returns the total score of `a`.
+int PlayMatch(const Options &options, const AiMctsConfig &a, const AiMctsConfig &b, unsigned seed) {
+    std::atomic<int> next_pair{0};
+    std::atomic<int> score{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < options.threads && t < options.game_pairs; ++t) {
+        threads.emplace_back([&]{
+            for (int i; (i = next_pair++) < options.game_pairs; ) {
+                score += PlayGame(a, b, seed + i, options.move_time);
+                score -= PlayGame(b, a, seed + i, options.move_time);
+            }
+        });
+    }
+    for (std::thread &thread : threads) thread.join();
+    return score;
+}
+
+void PrintUsage(std::ostream &os) {
+    os << "Usage: quarto-tune [<options>]\n"
+        "\n"
+        "Options:\n"
+        "  --steps=<count>        number of SPSA steps (default: 100)\n"
+        "  --games=<pairs>        pairs of games per step (default: 8)\n"
+        "  --threads=<count>      number of games to play in parallel (default: all cores)\n"
+        "  --move-time=<ms>       search time per move (default: 50)\n"
+        "  --learning-rate=<r>    initial step size, relative to the perturbation size\n"
+        "                         (default: 1)\n"
+        "  --params=<list>        comma-separated parameters to tune (default:\n"
+        "                         exploration_factor,evaluation_weight,playout_cutoff_depth)\n"
+        "                         out of:";
+    for (const Parameter &p : tunable_parameters) os << ' ' << p.name;
+    os << "\n"
+        "  --mcts-config=<name>=<value>,...\n"
+        "                         starting values and other fixed parameters\n"
+        "  --seed=<seed>          random seed (default: random)\n";
+}
+
+bool ParseOption(const std::string &arg, const std::string &name, std::string &value) {
+    std::string prefix = "--" + name + "=";
+    if (arg.compare(0, prefix.size(), prefix) != 0) return false;
+    value = arg.substr(prefix.size());
+    return true;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        std::string value;
+        if (ParseOption(arg, "steps", value)) {
+            options.steps = std::max(1, atoi(value.c_str()));
+        } else if (ParseOption(arg, "games", value)) {
+            options.game_pairs = std::max(1, atoi(value.c_str()));
+        } else if (ParseOption(arg, "threads", value)) {
+            options.threads = std::max(1, atoi(value.c_str()));
+        } else if (ParseOption(arg, "move-time", value)) {
+            options.move_time = std::chrono::milliseconds(std::max(1, atoi(value.c_str())));
+        } else if (ParseOption(arg, "learning-rate", value)) {
+            options.learning_rate = atof(value.c_str());
+        } else if (ParseOption(arg, "params", value)) {
+            options.params.clear();
+            std::istringstream iss(value);
+            for (std::string name; std::getline(iss, name, ','); ) options.params.push_back(name);
+        } else if (ParseOption(arg, "mcts-config", value)) {
+            if (!ParseAiMctsConfig(value, options.config)) {
+                std::cerr << "Invalid search parameters: " << value << '\n';
+                return 1;
+            }
+        } else if (ParseOption(arg, "seed", value)) {
+            options.seed = strtoul(value.c_str(), nullptr, 10);
+        } else if (arg == "-h" || arg == "--help") {
+            PrintUsage(std::cout);
+            return 0;
+        } else {
+            std::cerr << "Unexpected argument: " << arg << '\n';
+            PrintUsage(std::cerr);
+            return 1;
+        }
+    }
+
+    std::vector<Parameter> params;
+    std::vector<double> values;  // starting from the configured ones
+    for (const std::string &name : options.params) {
+        auto it = std::find_if(tunable_parameters.begin(), tunable_parameters.end(),
+                [&name](const Parameter &p) { return p.name == name; });
+        if (it == tunable_parameters.end()) {
+            std::cerr << "Unknown parameter: " << name << '\n';
+            return 1;
+        }
+        params.push_back(*it);
+        values.push_back(it->get(options.config));
+    }
+
+    std::mt19937 rng(options.seed);
+    for (int k = 0; k < options.steps; ++k) {
+        // Standard SPSA gain sequences, relative to their initial values.
+        const double stability = 0.1*options.steps;
+        const double c = 1 / pow(k + 1, 0.101);
+        const double a = options.learning_rate * pow((1 + stability) / (k + 1 + stability), 0.602);
+        std::vector<double> plus = values, minus = values;
+        std::vector<int> delta(params.size());
+        for (size_t i = 0; i < params.size(); ++i) {
+            delta[i] = rng() & 1 ? 1 : -1;
+            double step = c * params[i].perturbation * delta[i];
+            plus[i] = std::clamp(values[i] + step, params[i].min, params[i].max);
+            minus[i] = std::clamp(values[i] - step, params[i].min, params[i].max);
+        }
+        int score = PlayMatch(options, MakeConfig(options, params, plus),
+                MakeConfig(options, params, minus), rng());
+        // The score is between -1 and +1 per game.
+        double result = 1.0 * score / (2*options.game_pairs);
+        for (size_t i = 0; i < params.size(); ++i) {
+            values[i] = std::clamp(values[i] + a * c * params[i].perturbation * result * delta[i],
+                    params[i].min, params[i].max);
+        }
+        std::cout << "step " << (k + 1) << ": score " << score << '/' << 2*options.game_pairs
+                << ", " << FormatConfig(params, values) << std::endl;
+    }
+    std::cout << FormatConfig(params, values) << std::endl;
+    return 0;
+}